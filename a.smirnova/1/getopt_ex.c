@@ -1,6 +1,11 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +13,9 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 char *strdup(const char *s) {
@@ -20,7 +28,7 @@ char *strdup(const char *s) {
 }
 
 void print_usage(const char *progname) {
-  printf("Usage: %s [options]\n", progname);
+  printf("Usage: %s [options] [-- command [args...]]\n", progname);
   printf("Options:\n");
   printf("  -i    Print real and effective user and group IDs\n");
   printf("  -s    Process becomes group leader\n");
@@ -32,6 +40,15 @@ void print_usage(const char *progname) {
   printf("  -d    Print current working directory\n");
   printf("  -v    Print environment variables and their values\n");
   printf("  -V    Set environment variable (name=value)\n");
+  printf("  -P    Snapshot processes from /proc as JSON (pid[,pid...])\n");
+  printf("  -G    Snapshot every process of a group as JSON (0 = own group)\n");
+  printf("  -I    Sampling interval in milliseconds for -P/-G\n");
+  printf("  -n    Number of samples for -P/-G (0 = until killed)\n");
+  printf("  -L    Set any rlimit (name=value or name=soft:hard, e.g. nofile=4096)\n");
+  printf("  -e    Exec the command in place instead of profiling it\n");
+  printf("With a command, the settings above are applied and the command is\n");
+  printf("run; its wall/user/sys time, max RSS, page faults and context\n");
+  printf("switches are reported on stderr when it exits\n");
 }
 
 void print_user_group_ids() {
@@ -107,6 +124,79 @@ void change_core_size(const char *value) {
   change_rlimit(RLIMIT_CORE, value);
 }
 
+struct rlimit_name {
+  const char *name;
+  int resource;
+};
+
+static const struct rlimit_name rlimit_names[] = {
+    {"as", RLIMIT_AS},           {"core", RLIMIT_CORE},
+    {"cpu", RLIMIT_CPU},         {"data", RLIMIT_DATA},
+    {"fsize", RLIMIT_FSIZE},     {"locks", RLIMIT_LOCKS},
+    {"memlock", RLIMIT_MEMLOCK}, {"msgqueue", RLIMIT_MSGQUEUE},
+    {"nice", RLIMIT_NICE},       {"nofile", RLIMIT_NOFILE},
+    {"nproc", RLIMIT_NPROC},     {"rss", RLIMIT_RSS},
+    {"rtprio", RLIMIT_RTPRIO},   {"rttime", RLIMIT_RTTIME},
+    {"sigpending", RLIMIT_SIGPENDING}, {"stack", RLIMIT_STACK},
+};
+
+int parse_rlim_value(const char *s, char **end, rlim_t *value) {
+  if (strncmp(s, "unlimited", 9) == 0) {
+    *value = RLIM_INFINITY;
+    *end = (char *)s + 9;
+    return 0;
+  }
+  errno = 0;
+  unsigned long long v = strtoull(s, end, 10);
+  if (*end == s || errno != 0 || *s == '-') {
+    return -1;
+  }
+  *value = (rlim_t)v;
+  return 0;
+}
+
+// -L name=value sets both limits like -U/-C, name=soft:hard sets them apart
+void change_named_rlimit(const char *spec) {
+  const char *equals = strchr(spec, '=');
+  size_t name_len = equals ? (size_t)(equals - spec) : 0;
+  const struct rlimit_name *entry = NULL;
+  for (size_t i = 0; i < sizeof(rlimit_names) / sizeof(rlimit_names[0]); i++) {
+    if (strlen(rlimit_names[i].name) == name_len &&
+        strncmp(rlimit_names[i].name, spec, name_len) == 0) {
+      entry = &rlimit_names[i];
+      break;
+    }
+  }
+  if (entry == NULL) {
+    fprintf(stderr, "Invalid rlimit: %s (use name=value, e.g. nofile=4096)\n",
+            spec);
+    return;
+  }
+
+  struct rlimit rlim;
+  char *end;
+  if (parse_rlim_value(equals + 1, &end, &rlim.rlim_cur) == -1) {
+    fprintf(stderr, "Invalid value: %s\n", equals + 1);
+    return;
+  }
+  rlim.rlim_max = rlim.rlim_cur;
+  if (*end == ':' && parse_rlim_value(end + 1, &end, &rlim.rlim_max) == -1) {
+    fprintf(stderr, "Invalid value: %s\n", equals + 1);
+    return;
+  }
+  if (*end != '\0') {
+    fprintf(stderr, "Invalid value: %s\n", equals + 1);
+    return;
+  }
+
+  printf("Changing %s limit to %s...\n", entry->name, equals + 1);
+  if (setrlimit(entry->resource, &rlim) == -1) {
+    perror("setrlimit");
+    return;
+  }
+  printf("Rlimit %s changed to %s\n", entry->name, equals + 1);
+}
+
 void print_current_directory() {
   printf("Getting current directory...\n");
   char cwd[PATH_MAX];
@@ -161,11 +251,544 @@ int parse_name_value(const char *input, char **name, char **value) {
   return 0;
 }
 
+
+// Growable byte buffer shared by the /proc reader and the JSON writer.
+// A failed append marks it failed for good, so a record built from many
+// appends needs only one check at the end.
+struct buffer {
+  char *data;
+  size_t len;
+  size_t cap;
+  int failed;
+};
+
+int buffer_reserve(struct buffer *b, size_t extra) {
+  if (b->failed) {
+    return -1;
+  }
+  if (b->len + extra <= b->cap) {
+    return 0;
+  }
+  size_t cap = b->cap ? b->cap : 4096;
+  while (cap < b->len + extra) {
+    cap *= 2;
+  }
+  char *data = realloc(b->data, cap);
+  if (data == NULL) {
+    perror("realloc failed");
+    b->failed = 1;
+    return -1;
+  }
+  b->data = data;
+  b->cap = cap;
+  return 0;
+}
+
+int buffer_append(struct buffer *b, const char *s, size_t n) {
+  if (buffer_reserve(b, n) == -1) {
+    return -1;
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  return 0;
+}
+
+int buffer_printf(struct buffer *b, const char *fmt, ...) {
+  char tmp[128];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= sizeof(tmp)) {
+    b->failed = 1;
+    return -1;
+  }
+  return buffer_append(b, tmp, n);
+}
+
+// Length of the well-formed UTF-8 sequence at s (2 to 4 bytes), or 0 for
+// a stray, overlong, surrogate or out of range encoding
+size_t utf8_sequence(const unsigned char *s, size_t n) {
+  size_t len;
+  unsigned cp;
+  if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+    len = 2;
+    cp = s[0] & 0x1f;
+  } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+    len = 3;
+    cp = s[0] & 0x0f;
+  } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+    len = 4;
+    cp = s[0] & 0x07;
+  } else {
+    return 0;
+  }
+  if (len > n) {
+    return 0;
+  }
+  for (size_t i = 1; i < len; i++) {
+    if ((s[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    cp = cp << 6 | (s[i] & 0x3f);
+  }
+  if ((len == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) ||
+      (len == 4 && (cp < 0x10000 || cp > 0x10ffff))) {
+    return 0;
+  }
+  return len;
+}
+
+// environ, cmdline and comm are arbitrary bytes: anything that is not
+// valid UTF-8 becomes U+FFFD so the record stays valid JSON
+int buffer_json_string(struct buffer *b, const char *s, size_t n) {
+  buffer_append(b, "\"", 1);
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') {
+      char esc[2] = {'\\', (char)c};
+      buffer_append(b, esc, 2);
+    } else if (c < 0x20) {
+      buffer_printf(b, "\\u%04x", c);
+    } else if (c < 0x80) {
+      buffer_append(b, (const char *)&c, 1);
+    } else {
+      size_t len = utf8_sequence((const unsigned char *)s + i, n - i);
+      if (len == 0) {
+        buffer_append(b, "\\ufffd", 6);
+      } else {
+        buffer_append(b, s + i, len);
+        i += len - 1;
+      }
+    }
+  }
+  return buffer_append(b, "\"", 1);
+}
+
+// Read a whole /proc file relative to the process directory with one
+// openat() and as few read() calls as the buffer allows
+ssize_t read_proc_file(int dirfd, const char *name, struct buffer *b) {
+  int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+  b->len = 0;
+  while (1) {
+    if (buffer_reserve(b, 4096) == -1) {
+      close(fd);
+      return -1;
+    }
+    ssize_t n = read(fd, b->data + b->len, b->cap - b->len - 1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int saved = errno;
+      close(fd);
+      errno = saved;
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    b->len += n;
+  }
+  close(fd);
+  b->data[b->len] = '\0';
+  return b->len;
+}
+
+const char *status_field(const char *status, const char *key) {
+  size_t key_len = strlen(key);
+  for (const char *line = status; line != NULL && *line != '\0';) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+      return line + key_len + 1;
+    }
+    line = strchr(line, '\n');
+    if (line != NULL) {
+      line++;
+    }
+  }
+  return NULL;
+}
+
+void append_id_list(struct buffer *out, const char *key, const char *field) {
+  buffer_printf(out, ",\"%s\":[", key);
+  for (int i = 0; field != NULL && i < 4; i++) {
+    char *end;
+    long id = strtol(field, &end, 10);
+    if (end == field) {
+      break;
+    }
+    buffer_printf(out, i ? ",%ld" : "%ld", id);
+    field = end;
+  }
+  buffer_append(out, "]", 1);
+}
+
+// /proc/<pid>/limits is a fixed-width table: a 26 column name followed by
+// the soft and hard values, "unlimited" becomes null
+void append_limits(struct buffer *out, const char *limits) {
+  buffer_append(out, ",\"rlimits\":{", 12);
+  const char *line = strchr(limits, '\n');
+  int first = 1;
+  while (line != NULL && *++line != '\0') {
+    const char *eol = strchr(line, '\n');
+    if (eol == NULL || eol - line < 26) {
+      break;
+    }
+    const char *name = line;
+    if (strncmp(name, "Max ", 4) == 0) {
+      name += 4;
+    }
+    const char *name_end = line + 26;
+    while (name_end > name && name_end[-1] == ' ') {
+      name_end--;
+    }
+    buffer_append(out, first ? "\"" : ",\"", first ? 1 : 2);
+    for (const char *p = name; p < name_end; p++) {
+      char c = *p == ' ' ? '_' : *p;
+      buffer_append(out, &c, 1);
+    }
+    buffer_append(out, "\":[", 3);
+    const char *p = line + 26;
+    for (int i = 0; i < 2; i++) {
+      while (*p == ' ') {
+        p++;
+      }
+      if (i) {
+        buffer_append(out, ",", 1);
+      }
+      if (strncmp(p, "unlimited", 9) == 0) {
+        buffer_append(out, "null", 4);
+        p += 9;
+      } else {
+        char *end;
+        unsigned long long v = strtoull(p, &end, 10);
+        buffer_printf(out, "%llu", v);
+        p = end;
+      }
+    }
+    buffer_append(out, "]", 1);
+    first = 0;
+    line = eol;
+  }
+  buffer_append(out, "}", 1);
+}
+
+// Append one JSON record for the process behind dirfd; returns -1 when the
+// process is gone so the caller can drop it
+int snapshot_process(int dirfd, pid_t pid, const struct timespec *ts,
+                     struct buffer *out, struct buffer *scratch) {
+  size_t start = out->len;
+  if (read_proc_file(dirfd, "status", scratch) == -1) {
+    return -1;
+  }
+  buffer_printf(out, "{\"ts\":%lld.%09ld,\"pid\":%d", (long long)ts->tv_sec,
+                ts->tv_nsec, (int)pid);
+
+  const char *name = status_field(scratch->data, "Name");
+  if (name != NULL) {
+    while (*name == '\t' || *name == ' ') {
+      name++;
+    }
+    buffer_append(out, ",\"name\":", 8);
+    buffer_json_string(out, name, strcspn(name, "\n"));
+  }
+  const char *ppid = status_field(scratch->data, "PPid");
+  buffer_printf(out, ",\"ppid\":%ld", ppid ? strtol(ppid, NULL, 10) : -1L);
+
+  long pgid = -1;
+  const char *nspgid = status_field(scratch->data, "NSpgid");
+  if (nspgid != NULL) {
+    pgid = strtol(nspgid, NULL, 10);
+  }
+  append_id_list(out, "uid", status_field(scratch->data, "Uid"));
+  append_id_list(out, "gid", status_field(scratch->data, "Gid"));
+
+  if (nspgid == NULL && read_proc_file(dirfd, "stat", scratch) != -1) {
+    // Older kernels: pgrp is the fifth field of stat, after "(comm)"
+    const char *p = strrchr(scratch->data, ')');
+    if (p != NULL) {
+      sscanf(p + 1, " %*c %*d %ld", &pgid);
+    }
+  }
+  buffer_printf(out, ",\"pgid\":%ld", pgid);
+
+  if (read_proc_file(dirfd, "limits", scratch) != -1) {
+    append_limits(out, scratch->data);
+  } else {
+    buffer_append(out, ",\"rlimits\":null", 15);
+  }
+
+  char cwd[PATH_MAX];
+  ssize_t cwd_len = readlinkat(dirfd, "cwd", cwd, sizeof(cwd));
+  buffer_append(out, ",\"cwd\":", 7);
+  if (cwd_len >= 0) {
+    buffer_json_string(out, cwd, cwd_len);
+  } else {
+    buffer_append(out, "null", 4);
+  }
+
+  // environ needs ptrace access to the process, report null otherwise
+  buffer_append(out, ",\"env\":", 7);
+  if (read_proc_file(dirfd, "environ", scratch) != -1) {
+    buffer_append(out, "[", 1);
+    for (size_t off = 0; off < scratch->len;) {
+      size_t n = strlen(scratch->data + off);
+      if (off) {
+        buffer_append(out, ",", 1);
+      }
+      buffer_json_string(out, scratch->data + off, n);
+      off += n + 1;
+    }
+    buffer_append(out, "]", 1);
+  } else {
+    buffer_append(out, "null", 4);
+  }
+  // A failed append leaves a truncated record; drop it, the caller sees
+  // out->failed
+  if (buffer_append(out, "}\n", 2) == -1 || scratch->failed) {
+    out->len = start;
+    return -1;
+  }
+  return 0;
+}
+
+int open_proc_dir(int procfd, pid_t pid) {
+  char name[32];
+  snprintf(name, sizeof(name), "%d", (int)pid);
+  return openat(procfd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Tracked processes keep their /proc/<pid> descriptor across samples
+struct snapshot_target {
+  pid_t pid;
+  int dirfd;
+};
+
+int parse_pid_list(const char *list, struct snapshot_target **targets,
+                   size_t *count) {
+  size_t cap = 8;
+  *targets = malloc(cap * sizeof(**targets));
+  *count = 0;
+  if (*targets == NULL) {
+    perror("malloc failed");
+    return -1;
+  }
+  while (*list != '\0') {
+    char *end;
+    long pid = strtol(list, &end, 10);
+    if (end == list || pid <= 0 || (*end != ',' && *end != '\0')) {
+      fprintf(stderr, "Invalid pid list: %s\n", list);
+      return -1;
+    }
+    if (*count == cap) {
+      cap *= 2;
+      struct snapshot_target *t = realloc(*targets, cap * sizeof(**targets));
+      if (t == NULL) {
+        perror("realloc failed");
+        return -1;
+      }
+      *targets = t;
+    }
+    (*targets)[*count].pid = (pid_t)pid;
+    (*targets)[*count].dirfd = -1;
+    (*count)++;
+    list = *end == ',' ? end + 1 : end;
+  }
+  return 0;
+}
+
+// Append records for every process whose pgrp (stat field 5) matches
+void snapshot_group(int procfd, pid_t pgid, const struct timespec *ts,
+                    struct buffer *out, struct buffer *scratch) {
+  int fd = dup(procfd);
+  DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+  if (dir == NULL) {
+    perror("opendir /proc failed");
+    if (fd != -1) {
+      close(fd);
+    }
+    return;
+  }
+  rewinddir(dir);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+      continue;
+    }
+    pid_t pid = (pid_t)atoi(entry->d_name);
+    int dirfd = open_proc_dir(procfd, pid);
+    if (dirfd == -1) {
+      continue;
+    }
+    long pgrp = -1;
+    if (read_proc_file(dirfd, "stat", scratch) != -1) {
+      const char *p = strrchr(scratch->data, ')');
+      if (p != NULL) {
+        sscanf(p + 1, " %*c %*d %ld", &pgrp);
+      }
+    }
+    if (pgrp == (long)pgid) {
+      snapshot_process(dirfd, pid, ts, out, scratch);
+    }
+    close(dirfd);
+  }
+  closedir(dir);
+}
+
+void run_snapshot(const char *pid_list, long group, long interval_ms,
+                  long samples) {
+  struct snapshot_target *targets = NULL;
+  size_t count = 0;
+  if (pid_list != NULL && parse_pid_list(pid_list, &targets, &count) == -1) {
+    free(targets);
+    return;
+  }
+  int procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (procfd == -1) {
+    perror("open /proc failed");
+    free(targets);
+    return;
+  }
+  if (group == 0) {
+    group = getpgrp();
+  }
+  for (size_t i = 0; i < count; i++) {
+    targets[i].dirfd = open_proc_dir(procfd, targets[i].pid);
+  }
+
+  struct buffer out = {0}, scratch = {0};
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (long sample = 0; samples == 0 || sample < samples; sample++) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    out.len = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (targets[i].dirfd == -1 ||
+          snapshot_process(targets[i].dirfd, targets[i].pid, &now, &out,
+                           &scratch) == -1) {
+        buffer_printf(&out, "{\"ts\":%lld.%09ld,\"pid\":%d,\"error\":\"gone\"}\n",
+                      (long long)now.tv_sec, now.tv_nsec, (int)targets[i].pid);
+        if (targets[i].dirfd != -1) {
+          close(targets[i].dirfd);
+          targets[i].dirfd = -1;
+        }
+      }
+    }
+    if (group > 0) {
+      snapshot_group(procfd, (pid_t)group, &now, &out, &scratch);
+    }
+    if (out.failed || scratch.failed) {
+      fprintf(stderr, "Snapshot failed: out of memory\n");
+      break;
+    }
+    // One write per sample keeps records of a sample together in the pipe
+    fwrite(out.data, 1, out.len, stdout);
+    fflush(stdout);
+
+    if (samples != 0 && sample + 1 == samples) {
+      break;
+    }
+    next.tv_sec += interval_ms / 1000;
+    next.tv_nsec += (interval_ms % 1000) * 1000000L;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) ==
+           EINTR) {
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (targets[i].dirfd != -1) {
+      close(targets[i].dirfd);
+    }
+  }
+  close(procfd);
+  free(targets);
+  free(out.data);
+  free(scratch.data);
+}
+
+double timeval_seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Run the command with the limits and environment set up so far and report
+// its resource usage; returns the exit status to hand back to the caller
+int run_command(char *argv[], int exec_in_place) {
+  fflush(stdout);
+  if (exec_in_place) {
+    execvp(argv[0], argv);
+    perror("execvp failed");
+    return 127;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork failed");
+    return 1;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    perror("execvp failed");
+    _exit(127);
+  }
+
+  // Like time(1): terminal signals are meant for the child only
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+
+  int status;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) == -1) {
+    if (errno != EINTR) {
+      perror("wait4 failed");
+      return 1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall = (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  int exit_code;
+  fprintf(stderr, "\nCommand: %s\n", argv[0]);
+  if (WIFSIGNALED(status)) {
+    exit_code = 128 + WTERMSIG(status);
+    fprintf(stderr, "Killed by signal: %d (%s)\n", WTERMSIG(status),
+            strsignal(WTERMSIG(status)));
+  } else {
+    exit_code = WEXITSTATUS(status);
+    fprintf(stderr, "Exit status: %d\n", exit_code);
+  }
+  fprintf(stderr, "Wall time: %.6f s\n", wall);
+  fprintf(stderr, "User time: %.6f s\n", timeval_seconds(usage.ru_utime));
+  fprintf(stderr, "System time: %.6f s\n", timeval_seconds(usage.ru_stime));
+  fprintf(stderr, "Max RSS: %ld KB\n", usage.ru_maxrss);
+  fprintf(stderr, "Page faults: %ld minor, %ld major\n", usage.ru_minflt,
+          usage.ru_majflt);
+  fprintf(stderr, "Context switches: %ld voluntary, %ld involuntary\n",
+          usage.ru_nvcsw, usage.ru_nivcsw);
+  return exit_code;
+}
+
 int main(int argc, char *argv[]) {
   unsigned int op_count = 0;
   int opt = 0;
+  const char *snapshot_pids = NULL;
+  long snapshot_group_id = -1;
+  long interval_ms = 1000;
+  long samples = 1;
+  int sampling_set = 0;
+  int exec_in_place = 0;
 
-  while ((opt = getopt(argc, argv, "ispuU:cC:dvV:")) != -1) {
+  while ((opt = getopt(argc, argv, "ispuU:cC:dvV:P:G:I:n:L:e")) != -1) {
     op_count++;
     switch (opt) {
     case 'i':
@@ -207,6 +830,38 @@ int main(int argc, char *argv[]) {
       free(value);
       break;
     }
+    case 'P':
+      snapshot_pids = optarg;
+      break;
+    case 'G':
+      snapshot_group_id = atol(optarg);
+      if (snapshot_group_id < 0) {
+        fprintf(stderr, "Invalid process group: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'I':
+      interval_ms = atol(optarg);
+      if (interval_ms <= 0) {
+        fprintf(stderr, "Invalid interval: %s\n", optarg);
+        exit(1);
+      }
+      sampling_set = 1;
+      break;
+    case 'n':
+      samples = atol(optarg);
+      if (samples < 0) {
+        fprintf(stderr, "Invalid sample count: %s\n", optarg);
+        exit(1);
+      }
+      sampling_set = 1;
+      break;
+    case 'L':
+      change_named_rlimit(optarg);
+      break;
+    case 'e':
+      exec_in_place = 1;
+      break;
     case '?':
       print_usage(argv[0]);
       exit(1);
@@ -215,10 +870,20 @@ int main(int argc, char *argv[]) {
       exit(1);
     }
   }
-  if (op_count == 0) {
+  // -I and -n only shape a snapshot, alone they would do nothing
+  if ((op_count == 0 && optind == argc) ||
+      (sampling_set && snapshot_pids == NULL && snapshot_group_id < 0)) {
     print_usage(argv[0]);
     exit(1);
   }
 
+  if (snapshot_pids != NULL || snapshot_group_id >= 0) {
+    run_snapshot(snapshot_pids, snapshot_group_id, interval_ms, samples);
+  }
+
+  if (optind < argc) {
+    return run_command(argv + optind, exec_in_place);
+  }
+
   return 0;
 }
\ No newline at end of file
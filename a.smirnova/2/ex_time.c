@@ -1,16 +1,37 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "timing.h"
+#include "tz.h"
 
 extern char *tzname[];
 
-int main()
+#define MAX_ZONES 16
+#define MAX_THREADS 64
+#define BATCH_SIZE (64 << 20)
+// Smaller batches, e.g. one pipe read, are not worth another thread
+#define MIN_WORKER_BYTES (1 << 20)
+#define SECS_PER_DAY 86400L
+// Timestamps further out than about two billion years print "invalid":
+// beyond that the year no longer fits in an int and t + offset can
+// overflow
+#define TIME_LIMIT 63113904000000000LL
+
+static void print_california_time(void)
 {
     time_t now;
     struct tm *sp;
-    
+
     setenv("TZ", "PST8", 1);
     tzset();
 
@@ -24,6 +45,492 @@ int main()
         sp->tm_mon + 1, sp->tm_mday,
         sp->tm_year, sp->tm_hour,
         sp->tm_min, tzname[sp->tm_isdst]);
-    exit(0);
 }
 
+/*
+ * Streaming conversion. Zones come from the tz engine (tz.h) and are
+ * immutable, so workers never touch TZ or take a lock. Each worker still
+ * keeps a cache per zone with the UTC offset and the window [lo, hi) in
+ * which it is valid, so the transition table is only searched on a window
+ * miss and the calendar fields are recomputed only when the day changes.
+ */
+struct zone_cache {
+    int64_t lo, hi;
+    const struct tz_type *type;
+    int64_t day;
+    int year, mon, mday;
+};
+
+static struct tz_zone *zones[MAX_ZONES];
+static int zone_count = 0;
+static int print_stats = 0;
+static struct timing_recorder chunk_latency = TIMING_RECORDER_INIT("worker chunk");
+static struct timing_recorder batch_latency = TIMING_RECORDER_INIT("batch");
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    return a / b - (a % b < 0);
+}
+
+static char *put2(char *p, int v)
+{
+    p[0] = '0' + v / 10;
+    p[1] = '0' + v % 10;
+    return p + 2;
+}
+
+// "YYYY-MM-DD HH:MM:SS ABBR", at most 48 bytes. Always inlined so that
+// the fixed-offset and table-driven callers each get their own copy
+static inline __attribute__((always_inline)) char *
+format_local(char *p, struct zone_cache *c, const struct tz_zone *zone, int64_t t, int fixed)
+{
+    const struct tz_type *type;
+
+    if (fixed) {
+        type = &zone->fixed_type;
+    } else {
+        if (t < c->lo || t >= c->hi) {
+            struct tz_local loc;
+            tz_lookup_table(zone, t, &loc);
+            c->type = loc.type;
+            c->lo = loc.lo;
+            c->hi = loc.hi;
+        }
+        type = c->type;
+    }
+
+    int64_t local = t + type->offset;
+    int64_t day = floor_div(local, SECS_PER_DAY);
+    long secs = (long)(local - day * SECS_PER_DAY);
+
+    if (day != c->day) {
+        tz_civil_from_days(day, &c->year, &c->mon, &c->mday);
+        c->day = day;
+    }
+    if (c->year >= 0 && c->year <= 9999) {
+        p = put2(p, c->year / 100);
+        p = put2(p, c->year % 100);
+    } else {
+        p += sprintf(p, "%d", c->year);
+    }
+    *p++ = '-';
+    p = put2(p, c->mon);
+    *p++ = '-';
+    p = put2(p, c->mday);
+    *p++ = ' ';
+    p = put2(p, (int)(secs / 3600));
+    *p++ = ':';
+    p = put2(p, (int)(secs / 60 % 60));
+    *p++ = ':';
+    p = put2(p, (int)(secs % 60));
+    *p++ = ' ';
+    for (const char *a = type->abbr; *a; a++)
+        *p++ = *a;
+    return p;
+}
+
+struct worker {
+    pthread_t thread;
+    const char *in;
+    size_t in_len;
+    int binary;
+    int failed;                 // out holds only part of the records
+    char *out;
+    size_t out_len, out_cap;
+    struct timing_hist *latency;
+    struct zone_cache cache[MAX_ZONES];
+};
+
+static int worker_reserve(struct worker *w, size_t need)
+{
+    if (w->out_len + need <= w->out_cap)
+        return 0;
+    size_t cap = w->out_cap ? w->out_cap : 1 << 20;
+    while (cap < w->out_len + need)
+        cap *= 2;
+    char *out = realloc(w->out, cap);
+    if (out == NULL)
+        return -1;
+    w->out = out;
+    w->out_cap = cap;
+    return 0;
+}
+
+static void format_all_zones(struct worker *w, int64_t t)
+{
+    char *p = w->out + w->out_len;
+
+    for (int z = 0; z < zone_count; z++) {
+        if (z)
+            *p++ = '\t';
+        if (zones[z]->fixed)
+            p = format_local(p, &w->cache[z], zones[z], t, 1);
+        else
+            p = format_local(p, &w->cache[z], zones[z], t, 0);
+    }
+    *p++ = '\n';
+    w->out_len = p - w->out;
+}
+
+static void put_invalid(struct worker *w)
+{
+    memcpy(w->out + w->out_len, "invalid\n", 8);
+    w->out_len += 8;
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    const char *p = w->in, *end = w->in + w->in_len;
+    size_t per_line = (size_t)zone_count * 48 + 1;
+    TIMING_SCOPE(w->latency);
+
+    w->out_len = 0;
+    w->failed = 0;
+    while (p < end) {
+        if (worker_reserve(w, per_line) == -1) {
+            perror("realloc");
+            w->failed = 1;
+            return NULL;
+        }
+        if (w->binary) {
+            int64_t v;
+            memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            if (v < -TIME_LIMIT || v > TIME_LIMIT)
+                put_invalid(w);
+            else
+                format_all_zones(w, v);
+            continue;
+        }
+
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        const char *q = p;
+        int neg = 0;
+        int64_t v = 0;
+        while (q < eol && (*q == ' ' || *q == '\t'))
+            q++;
+        if (q < eol && *q == '-') {
+            neg = 1;
+            q++;
+        }
+        const char *digits = q;
+        // Past TIME_LIMIT the digits are only skipped, so v cannot overflow
+        while (q < eol && *q >= '0' && *q <= '9') {
+            if (v <= TIME_LIMIT)
+                v = v * 10 + (*q - '0');
+            q++;
+        }
+        // Only blanks may follow, so "12 34" or "123abc" is not a time
+        while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r'))
+            q++;
+        if (q == digits || q < eol || v > TIME_LIMIT) {
+            put_invalid(w);
+        } else {
+            format_all_zones(w, neg ? -v : v);
+        }
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            perror("write");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Split one batch among the workers on record boundaries, keep output order
+static int process_batch(struct worker *workers, int nthreads, const char *buf,
+                         size_t len, int binary)
+{
+    size_t start = 0;
+    int used = 0;
+    TIMING_SCOPE(timing_local_hist(&batch_latency));
+
+    if ((size_t)nthreads > len / MIN_WORKER_BYTES + 1)
+        nthreads = (int)(len / MIN_WORKER_BYTES + 1);
+    for (int i = 0; i < nthreads && start < len; i++) {
+        size_t cut = len;
+        if (i + 1 < nthreads) {
+            cut = start + (len - start) / (nthreads - i);
+            if (binary) {
+                cut -= cut % sizeof(int64_t);
+            } else {
+                const char *nl = memchr(buf + cut, '\n', len - cut);
+                cut = nl ? (size_t)(nl - buf) + 1 : len;
+            }
+            if (cut <= start)
+                continue;
+        }
+        workers[used].in = buf + start;
+        workers[used].in_len = cut - start;
+        workers[used].binary = binary;
+        if (pthread_create(&workers[used].thread, NULL, worker_run, &workers[used]) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        used++;
+        start = cut;
+    }
+    for (int i = 0; i < used; i++)
+        pthread_join(workers[i].thread, NULL);
+    for (int i = 0; i < used; i++)
+        if (workers[i].failed)
+            return -1;
+    for (int i = 0; i < used; i++)
+        if (write_all(STDOUT_FILENO, workers[i].out, workers[i].out_len) == -1)
+            return -1;
+    return 0;
+}
+
+static int stream_timestamps(int fd, int binary, int nthreads)
+{
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    char *buf = malloc(BATCH_SIZE);
+    size_t len = 0;
+    int rc = -1;
+
+    if (workers == NULL || buf == NULL) {
+        perror("malloc");
+        goto out;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        // Threads are recreated per batch, the histogram stays with the slot
+        workers[i].latency = timing_recorder_add(&chunk_latency);
+        for (int z = 0; z < MAX_ZONES; z++) {
+            workers[i].cache[z].day = INT64_MIN;
+            workers[i].cache[z].lo = workers[i].cache[z].hi = 0;
+        }
+    }
+
+    while (1) {
+        size_t want = BATCH_SIZE - len;
+        ssize_t n = read(fd, buf + len, want);
+        if (n == -1) {
+            perror("read");
+            goto out;
+        }
+        len += n;
+        // Fill the batch while data keeps coming. A short read means the
+        // writer has nothing more for now (tail -f into a pipe), so the
+        // complete records so far go out rather than wait for 64 MiB.
+        if (n > 0 && len < BATCH_SIZE && (size_t)n == want)
+            continue;
+
+        // Keep the incomplete trailing record for the next batch; a full
+        // buffer without a newline goes out as one record
+        size_t cut = len;
+        if (binary) {
+            cut -= cut % sizeof(int64_t);
+        } else if (n > 0) {
+            char *nl = memrchr(buf, '\n', len);
+            cut = nl ? (size_t)(nl - buf) + 1 : len < BATCH_SIZE ? 0 : len;
+        }
+        if (n > 0 && cut == 0)
+            continue;
+        if (process_batch(workers, nthreads, buf, cut, binary) == -1)
+            goto out;
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+        if (n == 0) {
+            if (len != 0) {
+                fprintf(stderr, "Truncated record: %zu trailing bytes\n", len);
+                goto out;
+            }
+            break;
+        }
+    }
+    rc = 0;
+out:
+    if (workers != NULL)
+        for (int i = 0; i < nthreads; i++)
+            free(workers[i].out);
+    free(workers);
+    free(buf);
+    return rc;
+}
+
+/*
+ * Per-call cost of every clock source. Each loop feeds the previous result
+ * into a volatile sink so the calls cannot be hoisted or merged.
+ */
+#define BENCH_CALLS 5000000
+
+static volatile uint64_t bench_sink;
+
+static void bench_report(const char *name, uint64_t start)
+{
+    double ns = (double)(timing_monotonic_ns() - start) / BENCH_CALLS;
+    printf("%-38s %8.2f ns/call\n", name, ns);
+}
+
+static void bench_clock_id(const char *name, clockid_t id)
+{
+    struct timespec ts;
+    uint64_t start = timing_monotonic_ns();
+
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        clock_gettime(id, &ts);
+        bench_sink += ts.tv_nsec;
+    }
+    bench_report(name, start);
+}
+
+static void bench_clocks(void)
+{
+    uint64_t start;
+    struct timeval tv;
+    struct timing_hist *hist;
+    static struct timing_recorder bench_latency = TIMING_RECORDER_INIT("TIMING_SCOPE");
+
+    timing_init();
+    printf("Clock source: %s\n", timing_source());
+
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++)
+        bench_sink += time(NULL);
+    bench_report("time()", start);
+
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        gettimeofday(&tv, NULL);
+        bench_sink += tv.tv_usec;
+    }
+    bench_report("gettimeofday()", start);
+
+    bench_clock_id("clock_gettime(CLOCK_REALTIME)", CLOCK_REALTIME);
+    bench_clock_id("clock_gettime(CLOCK_MONOTONIC)", CLOCK_MONOTONIC);
+    bench_clock_id("clock_gettime(CLOCK_MONOTONIC_COARSE)", CLOCK_MONOTONIC_COARSE);
+    bench_clock_id("clock_gettime(CLOCK_MONOTONIC_RAW)", CLOCK_MONOTONIC_RAW);
+
+#ifdef TIMING_HAVE_TSC
+    unsigned aux;
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++)
+        bench_sink += __rdtsc();
+    bench_report("rdtsc", start);
+
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++)
+        bench_sink += __rdtscp(&aux);
+    bench_report("rdtscp", start);
+#endif
+
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++)
+        bench_sink += timing_ticks();
+    bench_report("timing_ticks()", start);
+
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++)
+        bench_sink += timing_now_ns();
+    bench_report("timing_now_ns()", start);
+
+    hist = timing_local_hist(&bench_latency);
+    start = timing_monotonic_ns();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        TIMING_SCOPE(hist);
+        bench_sink++;
+    }
+    bench_report("TIMING_SCOPE (two reads + record)", start);
+    timing_recorder_print(&bench_latency, stdout);
+    timing_recorder_free(&bench_latency);
+}
+
+static void print_usage(const char *progname)
+{
+    printf("Usage: %s [-z zone]... [-b] [-j threads] [-s] [file]\n", progname);
+    printf("       %s -B\n", progname);
+    printf("Without options prints the current time in California (PST).\n");
+    printf("  -z    Convert epoch timestamps (one per line) to local time in zone,\n");
+    printf("        may be repeated, e.g. -z PST8 -z Europe/Moscow\n");
+    printf("  -b    Input is binary native-endian int64 timestamps\n");
+    printf("  -j    Number of worker threads (default: online CPUs)\n");
+    printf("  -s    Print batch and worker latency histograms to stderr\n");
+    printf("  -B    Benchmark the per-call cost of each clock source\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, binary = 0;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (argc == 1) {
+        print_california_time();
+        exit(0);
+    }
+
+    while ((opt = getopt(argc, argv, "z:bj:sB")) != -1) {
+        switch (opt) {
+        case 'z':
+            if (zone_count == MAX_ZONES) {
+                fprintf(stderr, "At most %d zones\n", MAX_ZONES);
+                exit(1);
+            }
+            if ((zones[zone_count] = tz_load(optarg)) == NULL) {
+                fprintf(stderr, "Unknown time zone: %s\n", optarg);
+                exit(1);
+            }
+            zone_count++;
+            break;
+        case 'b':
+            binary = 1;
+            break;
+        case 'j':
+            nthreads = atol(optarg);
+            break;
+        case 's':
+            print_stats = 1;
+            break;
+        case 'B':
+            bench_clocks();
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (zone_count == 0) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    // Latencies are only printed with -s; otherwise skip the calibration
+    if (print_stats)
+        timing_init();
+
+    int fd = STDIN_FILENO;
+    if (optind < argc && (fd = open(argv[optind], O_RDONLY)) == -1) {
+        perror("open");
+        exit(1);
+    }
+    int rc = stream_timestamps(fd, binary, (int)nthreads);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    for (int z = 0; z < zone_count; z++)
+        tz_free(zones[z]);
+    if (print_stats) {
+        fprintf(stderr, "Clock source: %s\n", timing_source());
+        timing_recorder_print(&batch_latency, stderr);
+        timing_recorder_print(&chunk_latency, stderr);
+    }
+    exit(rc == 0 ? 0 : 1);
+}
+
+// gcc -O2 -pthread ex_time.c tz.c timing.c -o ex_time
+// seq 1700000000 60 1760000000 | ./ex_time -z PST8 -z Europe/Moscow
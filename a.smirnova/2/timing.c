@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "timing.h"
+
+#ifdef TIMING_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+#define CALIBRATE_NS 20000000u
+#define LOCAL_SLOTS 16
+
+struct timing_clock timing_clock;
+
+#ifdef TIMING_HAVE_TSC
+// Invariant TSC: constant rate across P-states and idle, CPUID 0x80000007 EDX[8]
+static int tsc_invariant(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+#endif
+
+void timing_init(void)
+{
+    const char *force = getenv("TIMING_CLOCK");
+
+    timing_clock.use_tsc = 0;
+#ifdef TIMING_HAVE_TSC
+    if ((force != NULL && strcmp(force, "monotonic") == 0) || !tsc_invariant())
+        return;
+
+    uint64_t t0 = timing_monotonic_ns(), c0 = __rdtsc(), t1, c1;
+    do {
+        t1 = timing_monotonic_ns();
+        c1 = __rdtsc();
+    } while (t1 - t0 < CALIBRATE_NS);
+    if (c1 <= c0)
+        return;
+
+    timing_clock.mult = (uint64_t)(((unsigned __int128)(t1 - t0) << 32) / (c1 - c0));
+    timing_clock.tsc_base = c1;
+    timing_clock.ns_base = t1;
+    timing_clock.use_tsc = 1;
+#else
+    (void) force;
+#endif
+}
+
+const char *timing_source(void)
+{
+    return timing_clock.use_tsc ? "tsc" : "clock_gettime(CLOCK_MONOTONIC)";
+}
+
+void timing_hist_reset(struct timing_hist *h)
+{
+    for (unsigned i = 0; i < TIMING_BUCKETS; i++)
+        atomic_store_explicit(&h->counts[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&h->total, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->min, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+}
+
+// Lowest value that falls into a bucket
+uint64_t timing_bucket_value(unsigned bucket)
+{
+    if (bucket < TIMING_SUB_COUNT)
+        return bucket;
+    unsigned e = bucket / TIMING_SUB_COUNT + TIMING_SUB_BITS - 1;
+    uint64_t sub = bucket % TIMING_SUB_COUNT;
+    return (TIMING_SUB_COUNT + sub) << (e - TIMING_SUB_BITS);
+}
+
+uint64_t timing_hist_percentile(const struct timing_hist *h, double p)
+{
+    uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    uint64_t min = atomic_load_explicit(&h->min, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5), seen = 0;
+
+    if (total == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    for (unsigned i = 0; i < TIMING_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen >= rank) {
+            // Bucket lower bound, kept inside the observed range
+            uint64_t v = timing_bucket_value(i);
+            return v < min ? min : v > max ? max : v;
+        }
+    }
+    return max;
+}
+
+void timing_hist_print(const struct timing_hist *h, const char *name, FILE *out)
+{
+    uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+
+    if (total == 0) {
+        fprintf(out, "%s: no samples\n", name);
+        return;
+    }
+    fprintf(out, "%s: n=%llu mean=%llu ns min=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+            name, (unsigned long long)total,
+            (unsigned long long)(atomic_load_explicit(&h->sum, memory_order_relaxed) / total),
+            (unsigned long long)atomic_load_explicit(&h->min, memory_order_relaxed),
+            (unsigned long long)timing_hist_percentile(h, 50),
+            (unsigned long long)timing_hist_percentile(h, 90),
+            (unsigned long long)timing_hist_percentile(h, 99),
+            (unsigned long long)timing_hist_percentile(h, 99.9),
+            (unsigned long long)atomic_load_explicit(&h->max, memory_order_relaxed));
+}
+
+static _Thread_local struct {
+    struct timing_recorder *rec;
+    struct timing_hist *hist;
+} local_slots[LOCAL_SLOTS];
+
+struct timing_hist *timing_recorder_add(struct timing_recorder *rec)
+{
+    struct timing_hist *h = malloc(sizeof(*h));
+    if (h == NULL)
+        abort();
+    timing_hist_reset(h);
+
+    // Lock-free push onto the recorder's list of per-thread histograms
+    h->next = atomic_load_explicit(&rec->threads, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&rec->threads, &h->next, h,
+                                                  memory_order_release,
+                                                  memory_order_relaxed))
+        ;
+    return h;
+}
+
+struct timing_hist *timing_local_hist(struct timing_recorder *rec)
+{
+    int free_slot = -1;
+
+    for (int i = 0; i < LOCAL_SLOTS; i++) {
+        if (local_slots[i].rec == rec)
+            return local_slots[i].hist;
+        if (local_slots[i].rec == NULL && free_slot == -1)
+            free_slot = i;
+    }
+
+    struct timing_hist *h = timing_recorder_add(rec);
+    if (free_slot != -1) {
+        local_slots[free_slot].rec = rec;
+        local_slots[free_slot].hist = h;
+    }
+    return h;
+}
+
+void timing_recorder_snapshot(struct timing_recorder *rec, struct timing_hist *out)
+{
+    timing_hist_reset(out);
+    for (struct timing_hist *h = atomic_load_explicit(&rec->threads, memory_order_acquire);
+         h != NULL; h = h->next) {
+        for (unsigned i = 0; i < TIMING_BUCKETS; i++)
+            TIMING_BUMP(out->counts[i], atomic_load_explicit(&h->counts[i], memory_order_relaxed));
+        TIMING_BUMP(out->total, atomic_load_explicit(&h->total, memory_order_relaxed));
+        TIMING_BUMP(out->sum, atomic_load_explicit(&h->sum, memory_order_relaxed));
+        uint64_t min = atomic_load_explicit(&h->min, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+        if (min < atomic_load_explicit(&out->min, memory_order_relaxed))
+            atomic_store_explicit(&out->min, min, memory_order_relaxed);
+        if (max > atomic_load_explicit(&out->max, memory_order_relaxed))
+            atomic_store_explicit(&out->max, max, memory_order_relaxed);
+    }
+}
+
+void timing_recorder_print(struct timing_recorder *rec, FILE *out)
+{
+    struct timing_hist *sum = malloc(sizeof(*sum));
+
+    if (sum == NULL)
+        return;
+    timing_recorder_snapshot(rec, sum);
+    timing_hist_print(sum, rec->name, out);
+    free(sum);
+}
+
+// Only once no thread records into rec any more
+void timing_recorder_free(struct timing_recorder *rec)
+{
+    struct timing_hist *h = atomic_exchange(&rec->threads, NULL);
+
+    while (h != NULL) {
+        struct timing_hist *next = h->next;
+        free(h);
+        h = next;
+    }
+    for (int i = 0; i < LOCAL_SLOTS; i++)
+        if (local_slots[i].rec == rec)
+            local_slots[i].rec = NULL;
+}
@@ -0,0 +1,166 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// x86-64 only: the tick conversion needs a 128-bit multiply
+#ifdef __x86_64__
+#include <x86intrin.h>
+#define TIMING_HAVE_TSC 1
+#endif
+
+/*
+ * Low-overhead clock and latency histograms.
+ *
+ * timing_init() calibrates the TSC against CLOCK_MONOTONIC when the CPU
+ * reports an invariant TSC; otherwise (or with TIMING_CLOCK=monotonic in
+ * the environment) every read goes through clock_gettime, which is served
+ * by the vDSO without a system call. Call it once before starting threads;
+ * calibration busy-waits for 20 ms, so only modes that time something do.
+ * Until then the clock is clock_gettime.
+ */
+
+struct timing_clock {
+    int use_tsc;
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    uint64_t mult;              // ns per tick, 32.32 fixed point
+};
+
+extern struct timing_clock timing_clock;
+
+void timing_init(void);
+const char *timing_source(void);
+
+static inline uint64_t timing_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Raw ticks: TSC cycles or nanoseconds, only differences are meaningful
+static inline uint64_t timing_ticks(void)
+{
+#ifdef TIMING_HAVE_TSC
+    if (timing_clock.use_tsc)
+        return __rdtsc();
+#endif
+    return timing_monotonic_ns();
+}
+
+static inline uint64_t timing_ticks_to_ns(uint64_t ticks)
+{
+#ifdef TIMING_HAVE_TSC
+    if (timing_clock.use_tsc)
+        return (uint64_t)(((unsigned __int128)ticks * timing_clock.mult) >> 32);
+#endif
+    return ticks;
+}
+
+static inline uint64_t timing_now_ns(void)
+{
+    if (!timing_clock.use_tsc)
+        return timing_monotonic_ns();
+    return timing_clock.ns_base + timing_ticks_to_ns(timing_ticks() - timing_clock.tsc_base);
+}
+
+/*
+ * HDR-style log-linear histogram of nanosecond values: values below
+ * 2^TIMING_SUB_BITS get exact buckets, every power of two above that is
+ * split into 2^TIMING_SUB_BITS buckets, so the relative error stays under
+ * 1/32 up to 2^64 ns.
+ *
+ * Each thread records into its own histogram, so recording is a couple of
+ * relaxed atomic stores with no read-modify-write. Readers sum the
+ * per-thread histograms of a recorder while writers keep running.
+ */
+#define TIMING_SUB_BITS 5
+#define TIMING_SUB_COUNT (1 << TIMING_SUB_BITS)
+#define TIMING_BUCKETS ((64 - TIMING_SUB_BITS + 1) * TIMING_SUB_COUNT)
+
+struct timing_hist {
+    _Atomic uint64_t counts[TIMING_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t min;
+    _Atomic uint64_t max;
+    struct timing_hist *next;
+};
+
+struct timing_recorder {
+    const char *name;
+    _Atomic(struct timing_hist *) threads;
+};
+
+#define TIMING_RECORDER_INIT(label) { (label), NULL }
+
+static inline unsigned timing_bucket(uint64_t v)
+{
+    if (v < TIMING_SUB_COUNT)
+        return (unsigned)v;
+    unsigned e = 63 - __builtin_clzll(v);
+    unsigned sub = (unsigned)(v >> (e - TIMING_SUB_BITS)) & (TIMING_SUB_COUNT - 1);
+    return (e - TIMING_SUB_BITS + 1) * TIMING_SUB_COUNT + sub;
+}
+
+// Single writer per histogram: plain load + store, never a locked op
+#define TIMING_BUMP(field, delta) \
+    atomic_store_explicit(&(field), \
+        atomic_load_explicit(&(field), memory_order_relaxed) + (delta), \
+        memory_order_relaxed)
+
+static inline void timing_hist_record(struct timing_hist *h, uint64_t ns)
+{
+    TIMING_BUMP(h->counts[timing_bucket(ns)], 1);
+    TIMING_BUMP(h->total, 1);
+    TIMING_BUMP(h->sum, ns);
+    if (ns < atomic_load_explicit(&h->min, memory_order_relaxed))
+        atomic_store_explicit(&h->min, ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+void timing_hist_reset(struct timing_hist *h);
+uint64_t timing_bucket_value(unsigned bucket);
+uint64_t timing_hist_percentile(const struct timing_hist *h, double p);
+void timing_hist_print(const struct timing_hist *h, const char *name, FILE *out);
+
+// A new histogram in rec for a caller that keeps it to a single writer,
+// e.g. a worker slot reused by short-lived threads
+struct timing_hist *timing_recorder_add(struct timing_recorder *rec);
+// The calling thread's histogram for rec, created on first use
+struct timing_hist *timing_local_hist(struct timing_recorder *rec);
+// Sum of all per-thread histograms of rec into *out
+void timing_recorder_snapshot(struct timing_recorder *rec, struct timing_hist *out);
+void timing_recorder_print(struct timing_recorder *rec, FILE *out);
+void timing_recorder_free(struct timing_recorder *rec);
+
+/*
+ * Scoped timer: records the time until the end of the enclosing block.
+ *
+ *     {
+ *         TIMING_SCOPE(timing_local_hist(&parse_latency));
+ *         parse(...);
+ *     }
+ */
+struct timing_scope {
+    struct timing_hist *hist;
+    uint64_t start;
+};
+
+static inline void timing_scope_end(struct timing_scope *s)
+{
+    timing_hist_record(s->hist, timing_ticks_to_ns(timing_ticks() - s->start));
+}
+
+#define TIMING_CAT_(a, b) a##b
+#define TIMING_CAT(a, b) TIMING_CAT_(a, b)
+#define TIMING_SCOPE(hist) \
+    struct timing_scope TIMING_CAT(timing_scope_, __LINE__) \
+        __attribute__((cleanup(timing_scope_end))) = { (hist), timing_ticks() }
+
+#endif
@@ -0,0 +1,505 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tz.h"
+
+#define SECS_PER_DAY 86400
+#define RULE_TABLE_LAST_YEAR 2100
+
+static int64_t floor_div64(int64_t a, int64_t b)
+{
+    return a / b - (a % b < 0);
+}
+
+int64_t tz_days_from_civil(int year, int mon, int mday)
+{
+    int64_t y = year - (mon <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+// Days since 1970-01-01 to a proleptic Gregorian date (H. Hinnant)
+void tz_civil_from_days(int64_t z, int *year, int *mon, int *mday)
+{
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+
+    *mday = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *mon = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *year = (int)(yoe + era * 400 + (*mon <= 2));
+}
+
+static int is_leap(int year)
+{
+    return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+/* POSIX TZ strings */
+
+static const char *parse_abbr(const char *s, char *out)
+{
+    size_t n = 0;
+
+    if (*s == '<') {
+        s++;
+        while (*s && *s != '>') {
+            if (n + 1 < TZ_ABBR_MAX)
+                out[n++] = *s;
+            s++;
+        }
+        if (*s++ != '>')
+            return NULL;
+    } else {
+        const char *start = s;
+        while (isalpha((unsigned char)*s)) {
+            if (n + 1 < TZ_ABBR_MAX)
+                out[n++] = *s;
+            s++;
+        }
+        if (s - start < 3)
+            return NULL;
+    }
+    out[n] = '\0';
+    return s;
+}
+
+// [+-]hh[:mm[:ss]]
+static const char *parse_hms(const char *s, int32_t *secs)
+{
+    int sign = 1, part = 0;
+    int32_t v[3] = {0, 0, 0};
+
+    if (*s == '+' || *s == '-')
+        sign = *s++ == '-' ? -1 : 1;
+    if (!isdigit((unsigned char)*s))
+        return NULL;
+    while (part < 3) {
+        while (isdigit((unsigned char)*s))
+            v[part] = v[part] * 10 + (*s++ - '0');
+        if (*s != ':' || part == 2)
+            break;
+        s++;
+        part++;
+    }
+    *secs = sign * (v[0] * 3600 + v[1] * 60 + v[2]);
+    return s;
+}
+
+static const char *parse_rule_date(const char *s, struct tz_rule_date *d)
+{
+    char *end;
+
+    if (*s == 'M') {
+        d->kind = 'M';
+        d->mon = (int)strtol(s + 1, &end, 10);
+        if (*end != '.')
+            return NULL;
+        d->week = (int)strtol(end + 1, &end, 10);
+        if (*end != '.')
+            return NULL;
+        d->day = (int)strtol(end + 1, &end, 10);
+        if (d->mon < 1 || d->mon > 12 || d->week < 1 || d->week > 5 ||
+            d->day < 0 || d->day > 6)
+            return NULL;
+    } else {
+        d->kind = 'D';
+        if (*s == 'J') {
+            d->kind = 'J';
+            s++;
+        }
+        if (!isdigit((unsigned char)*s))
+            return NULL;
+        d->day = (int)strtol(s, &end, 10);
+    }
+    s = end;
+    d->time = 2 * 3600;
+    if (*s == '/')
+        s = parse_hms(s + 1, &d->time);
+    return s;
+}
+
+int tz_parse_posix(const char *s, struct tz_rule *rule)
+{
+    int32_t secs;
+
+    memset(rule, 0, sizeof(*rule));
+    if ((s = parse_abbr(s, rule->std.abbr)) == NULL ||
+        (s = parse_hms(s, &secs)) == NULL)
+        return -1;
+    // POSIX counts hours west of Greenwich
+    rule->std.offset = -secs;
+    if (*s == '\0')
+        return 0;
+
+    if ((s = parse_abbr(s, rule->dst.abbr)) == NULL)
+        return -1;
+    rule->has_dst = 1;
+    rule->dst.isdst = 1;
+    rule->dst.offset = rule->std.offset + 3600;
+    if (*s && *s != ',') {
+        if ((s = parse_hms(s, &secs)) == NULL)
+            return -1;
+        rule->dst.offset = -secs;
+    }
+    if (*s == '\0') {
+        // Same default as glibc: the US rules
+        s = ",M3.2.0,M11.1.0";
+    }
+    if (*s++ != ',' || (s = parse_rule_date(s, &rule->start)) == NULL ||
+        *s++ != ',' || (s = parse_rule_date(s, &rule->end)) == NULL)
+        return -1;
+    return *s == '\0' ? 0 : -1;
+}
+
+static int64_t rule_date_days(const struct tz_rule_date *d, int year)
+{
+    int64_t jan1 = tz_days_from_civil(year, 1, 1);
+
+    if (d->kind == 'J')
+        return jan1 + d->day - 1 + (is_leap(year) && d->day >= 60);
+    if (d->kind == 'D')
+        return jan1 + d->day;
+
+    static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int64_t first = tz_days_from_civil(year, d->mon, 1);
+    int first_wday = (int)(first + 4 - floor_div64(first + 4, 7) * 7);
+    int64_t day = first + (d->day - first_wday + 7) % 7 + (int64_t)(d->week - 1) * 7;
+    int len = month_days[d->mon - 1] + (d->mon == 2 && is_leap(year));
+    while (day >= first + len)
+        day -= 7;
+    return day;
+}
+
+// UTC instants at which DST starts and ends in a given year
+static void rule_transitions(const struct tz_rule *r, int year, int64_t *start, int64_t *end)
+{
+    *start = rule_date_days(&r->start, year) * SECS_PER_DAY + r->start.time - r->std.offset;
+    *end = rule_date_days(&r->end, year) * SECS_PER_DAY + r->end.time - r->dst.offset;
+}
+
+static void rule_lookup(const struct tz_rule *r, int64_t t, struct tz_local *out)
+{
+    int64_t times[6];
+    int dst[6], n = 0, year, mon, mday;
+
+    if (!r->has_dst) {
+        out->type = &r->std;
+        out->lo = INT64_MIN;
+        out->hi = INT64_MAX;
+        return;
+    }
+    tz_civil_from_days(floor_div64(t + r->std.offset, SECS_PER_DAY), &year, &mon, &mday);
+    for (int y = year - 1; y <= year + 1; y++) {
+        rule_transitions(r, y, &times[n], &times[n + 1]);
+        dst[n++] = 1;
+        dst[n++] = 0;
+    }
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && times[j - 1] > times[j]; j--) {
+            int64_t tmp = times[j];
+            times[j] = times[j - 1];
+            times[j - 1] = tmp;
+            int d = dst[j];
+            dst[j] = dst[j - 1];
+            dst[j - 1] = d;
+        }
+    }
+    int i = n - 1;
+    while (i > 0 && times[i] > t)
+        i--;
+    out->type = dst[i] ? &r->dst : &r->std;
+    out->lo = times[i];
+    out->hi = i + 1 < n ? times[i + 1] : INT64_MAX;
+}
+
+int tz_lookup_table(const struct tz_zone *z, int64_t t, struct tz_local *out)
+{
+    if (z->fixed) {
+        out->type = &z->fixed_type;
+        out->lo = INT64_MIN;
+        out->hi = INT64_MAX;
+        return 0;
+    }
+    if (z->count == 0 || t < z->times[0]) {
+        if (z->has_rule && z->rule_before) {
+            rule_lookup(&z->rule, t, out);
+            if (z->count > 0 && out->hi > z->times[0])
+                out->hi = z->times[0];
+            return 0;
+        }
+        out->type = &z->initial;
+        out->lo = INT64_MIN;
+        out->hi = z->count > 0 ? z->times[0] : INT64_MAX;
+        return 0;
+    }
+
+    size_t lo = 0, hi = z->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (z->times[mid] <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (lo + 1 == z->count && z->has_rule) {
+        rule_lookup(&z->rule, t, out);
+        if (out->lo < z->times[lo])
+            out->lo = z->times[lo];
+        return 0;
+    }
+    out->type = &z->type_table[z->types[lo]];
+    out->lo = z->times[lo];
+    out->hi = lo + 1 < z->count ? z->times[lo + 1] : INT64_MAX;
+    return 0;
+}
+
+int tz_to_local(const struct tz_zone *zone, int64_t t, struct tz_tm *tm)
+{
+    struct tz_local loc;
+
+    if (tz_lookup(zone, t, &loc) == -1)
+        return -1;
+
+    int64_t local = t + loc.type->offset;
+    int64_t days = floor_div64(local, SECS_PER_DAY);
+    int secs = (int)(local - days * SECS_PER_DAY);
+
+    tz_civil_from_days(days, &tm->year, &tm->mon, &tm->mday);
+    tm->hour = secs / 3600;
+    tm->min = secs / 60 % 60;
+    tm->sec = secs % 60;
+    tm->wday = (int)(days + 4 - floor_div64(days + 4, 7) * 7);
+    tm->yday = (int)(days - tz_days_from_civil(tm->year, 1, 1));
+    tm->offset = loc.type->offset;
+    tm->isdst = loc.type->isdst;
+    tm->abbr = loc.type->abbr;
+    return 0;
+}
+
+/* TZif files (RFC 8536) */
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int64_t be64(const unsigned char *p)
+{
+    return (int64_t)((uint64_t)be32(p) << 32 | be32(p + 4));
+}
+
+static unsigned char *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char *buf = NULL;
+
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size > (16 << 20))
+        goto out;
+    buf = malloc(st.st_size + 1);
+    if (buf == NULL)
+        goto out;
+    *len = 0;
+    while (*len < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + *len, st.st_size - *len);
+        if (n <= 0) {
+            free(buf);
+            buf = NULL;
+            goto out;
+        }
+        *len += n;
+    }
+    buf[*len] = '\0';
+out:
+    close(fd);
+    return buf;
+}
+
+static int grow_table(struct tz_zone *z, size_t count)
+{
+    int64_t *times = realloc(z->times, count * sizeof(*times));
+    if (times == NULL)
+        return -1;
+    z->times = times;
+    uint16_t *types = realloc(z->types, count * sizeof(*types));
+    if (types == NULL)
+        return -1;
+    z->types = types;
+    return 0;
+}
+
+static int parse_tzif(struct tz_zone *z, const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+    size_t tsize = 4;
+
+    if (len < 44 || memcmp(p, "TZif", 4) != 0)
+        return -1;
+    // Version 2+ repeats the data with 64-bit times after the v1 block
+    if (p[4] >= '2') {
+        size_t v1 = 44 + be32(p + 32) * 5 + be32(p + 36) * 6 + be32(p + 40) +
+                    be32(p + 28) * 8 + be32(p + 24) + be32(p + 20);
+        if (v1 + 44 > len || memcmp(p + v1, "TZif", 4) != 0)
+            return -1;
+        p += v1;
+        tsize = 8;
+    }
+
+    size_t isutcnt = be32(p + 20), isstdcnt = be32(p + 24), leapcnt = be32(p + 28);
+    size_t timecnt = be32(p + 32), typecnt = be32(p + 36), charcnt = be32(p + 40);
+    const unsigned char *times = p + 44;
+    const unsigned char *idx = times + timecnt * tsize;
+    const unsigned char *ttinfo = idx + timecnt;
+    const unsigned char *chars = ttinfo + typecnt * 6;
+    const unsigned char *footer = chars + charcnt + leapcnt * (tsize + 4) + isstdcnt + isutcnt;
+
+    if (typecnt == 0 || typecnt > 256 || footer > end)
+        return -1;
+
+    z->type_table = calloc(typecnt + 2, sizeof(*z->type_table));
+    if (z->type_table == NULL || (timecnt > 0 && grow_table(z, timecnt) == -1))
+        return -1;
+    z->type_count = typecnt;
+    for (size_t i = 0; i < typecnt; i++) {
+        struct tz_type *t = &z->type_table[i];
+        size_t desig = ttinfo[i * 6 + 5];
+        t->offset = (int32_t)be32(ttinfo + i * 6);
+        t->isdst = ttinfo[i * 6 + 4];
+        if (desig < charcnt) {
+            strncpy(t->abbr, (const char *)chars + desig, TZ_ABBR_MAX - 1);
+            t->abbr[TZ_ABBR_MAX - 1] = '\0';
+        }
+    }
+    for (size_t i = 0; i < timecnt; i++) {
+        z->times[i] = tsize == 8 ? be64(times + i * 8) : (int32_t)be32(times + i * 4);
+        z->types[i] = idx[i] < typecnt ? idx[i] : 0;
+    }
+    z->count = timecnt;
+    z->initial = z->type_table[0];
+
+    // Footer: "\n<POSIX TZ>\n" governs times after the last transition
+    if (tsize == 8 && footer < end && *footer == '\n') {
+        const unsigned char *nl = memchr(footer + 1, '\n', end - footer - 1);
+        if (nl != NULL && nl > footer + 1) {
+            char spec[128];
+            size_t n = nl - footer - 1;
+            if (n < sizeof(spec)) {
+                memcpy(spec, footer + 1, n);
+                spec[n] = '\0';
+                if (tz_parse_posix(spec, &z->rule) == 0 && z->rule.has_dst)
+                    z->has_rule = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Precompile the rule into the table so ordinary dates are a binary search
+static int expand_rule(struct tz_zone *z)
+{
+    int year = 1970, mon, mday;
+    uint16_t std = (uint16_t)z->type_count, dst = std + 1;
+
+    if (z->count > 0)
+        tz_civil_from_days(floor_div64(z->times[z->count - 1], SECS_PER_DAY), &year, &mon, &mday);
+    if (grow_table(z, z->count + 2 * (RULE_TABLE_LAST_YEAR - year + 2)) == -1)
+        return -1;
+    z->type_table[std] = z->rule.std;
+    z->type_table[dst] = z->rule.dst;
+    z->type_count += 2;
+
+    for (int y = year; y <= RULE_TABLE_LAST_YEAR; y++) {
+        int64_t t[2];
+        uint16_t type[2] = {dst, std};
+        rule_transitions(&z->rule, y, &t[0], &t[1]);
+        if (t[1] < t[0]) {
+            int64_t tmp = t[0];
+            t[0] = t[1];
+            t[1] = tmp;
+            type[0] = std;
+            type[1] = dst;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (z->count > 0 && t[i] <= z->times[z->count - 1])
+                continue;
+            z->times[z->count] = t[i];
+            z->types[z->count] = type[i];
+            z->count++;
+        }
+    }
+    return 0;
+}
+
+struct tz_zone *tz_load(const char *name)
+{
+    struct tz_zone *z = calloc(1, sizeof(*z));
+    char path[4096];
+    unsigned char *data;
+    size_t len;
+
+    if (z == NULL)
+        return NULL;
+    if (*name == ':')
+        name++;
+
+    if (*name == '/') {
+        snprintf(path, sizeof(path), "%s", name);
+    } else {
+        const char *dir = getenv("TZDIR");
+        snprintf(path, sizeof(path), "%s/%s", dir ? dir : "/usr/share/zoneinfo", name);
+    }
+
+    data = strstr(name, "..") == NULL ? read_file(path, &len) : NULL;
+    if (data != NULL) {
+        int rc = parse_tzif(z, data, len);
+        free(data);
+        if (rc == -1)
+            goto fail;
+    } else {
+        if (tz_parse_posix(name, &z->rule) == -1)
+            goto fail;
+        z->initial = z->rule.std;
+        z->has_rule = z->rule.has_dst;
+        z->rule_before = 1;
+        z->type_table = calloc(2, sizeof(*z->type_table));
+        if (z->type_table == NULL)
+            goto fail;
+    }
+
+    if (z->has_rule && expand_rule(z) == -1)
+        goto fail;
+    if (z->count == 0 && !z->has_rule) {
+        z->fixed = 1;
+        z->fixed_type = z->initial;
+    }
+    return z;
+fail:
+    tz_free(z);
+    return NULL;
+}
+
+void tz_free(struct tz_zone *z)
+{
+    if (z == NULL)
+        return;
+    free(z->times);
+    free(z->types);
+    free(z->type_table);
+    free(z);
+}
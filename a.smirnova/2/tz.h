@@ -0,0 +1,101 @@
+#ifndef TZ_H
+#define TZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Small timezone engine. A zone is loaded once from a TZif file under
+ * $TZDIR (default /usr/share/zoneinfo) or parsed from a POSIX TZ string
+ * such as "PST8" or "CET-1CEST,M3.5.0,M10.5.0/3", and is immutable
+ * afterwards: every lookup is a pure function of (zone, t), so any number
+ * of threads can convert for any number of zones without locks and
+ * without touching TZ, tzset() or tzname[].
+ */
+
+#define TZ_ABBR_MAX 8
+
+struct tz_type {
+    int32_t offset;             // seconds east of UTC
+    int isdst;
+    char abbr[TZ_ABBR_MAX];
+};
+
+// POSIX rule date: Jn (julian, no Feb 29), n (zero-based day) or Mm.w.d
+struct tz_rule_date {
+    char kind;                  // 'J', 'D' or 'M'
+    int day, week, mon;
+    int32_t time;               // local wall clock seconds, may be negative
+};
+
+struct tz_rule {
+    struct tz_type std, dst;
+    int has_dst;
+    struct tz_rule_date start, end;
+};
+
+struct tz_zone {
+    int fixed;                  // one offset forever, see tz_lookup()
+    struct tz_type fixed_type;
+
+    // Sorted transition table, types[i] is in effect from times[i] on
+    size_t count;
+    int64_t *times;
+    uint16_t *types;
+    struct tz_type *type_table;
+    size_t type_count;
+    struct tz_type initial;     // before the first transition
+    int rule_before;            // the rule also governs before the table
+
+    // Evaluated on the fly after the last table entry
+    int has_rule;
+    struct tz_rule rule;
+};
+
+// Offset in effect at t and the window [lo, hi) for which it stays valid
+struct tz_local {
+    const struct tz_type *type;
+    int64_t lo, hi;
+};
+
+// Broken-down local time, like struct tm without the global state
+struct tz_tm {
+    int year, mon, mday;        // full year, 1-12, 1-31
+    int hour, min, sec;
+    int wday, yday;             // 0 = Sunday, 0-365
+    int32_t offset;
+    int isdst;
+    const char *abbr;
+};
+
+struct tz_zone *tz_load(const char *name);
+int tz_parse_posix(const char *spec, struct tz_rule *rule);
+void tz_free(struct tz_zone *zone);
+
+int tz_lookup_table(const struct tz_zone *zone, int64_t t, struct tz_local *out);
+int tz_to_local(const struct tz_zone *zone, int64_t t, struct tz_tm *out);
+void tz_civil_from_days(int64_t days, int *year, int *mon, int *mday);
+int64_t tz_days_from_civil(int year, int mon, int mday);
+
+/*
+ * Fixed-offset zones never look at a table. A zone declared with
+ * TZ_FIXED_ZONE is a compile-time constant, so once tz_lookup() is inlined
+ * the compiler folds the whole conversion down to an addition.
+ */
+#define TZ_FIXED_ZONE(var, seconds, name) \
+    static const struct tz_zone var = { \
+        .fixed = 1, .fixed_type = { (seconds), 0, name } }
+
+static inline int tz_lookup(const struct tz_zone *zone, int64_t t, struct tz_local *out)
+{
+    if (zone->fixed) {
+        out->type = &zone->fixed_type;
+        out->lo = INT64_MIN;
+        out->hi = INT64_MAX;
+        return 0;
+    }
+    return tz_lookup_table(zone, t, out);
+}
+
+#endif
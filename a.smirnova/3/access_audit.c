@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "access_audit.h"
+
+#define DENTS_BUF 65536
+#define OUT_BUF 65536
+#define MAX_OPEN_DIRS 512
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Pending directory; fd is -1 when the open-descriptor budget was spent
+// and the directory has to be reopened by path
+struct dir_item {
+    struct dir_item *next;
+    int fd;
+    char path[];
+};
+
+struct audit {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct dir_item *stack;
+    int active;
+    int same_identity;
+    atomic_int open_dirs;
+
+    pthread_mutex_t out_lock;
+    int out_fd;
+
+    atomic_ulong files, dirs, differ, errors;
+};
+
+struct worker_out {
+    char buf[OUT_BUF];
+    size_t len;
+};
+
+static void flush_out(struct audit *a, struct worker_out *out) {
+    pthread_mutex_lock(&a->out_lock);
+    for (size_t off = 0; off < out->len;) {
+        ssize_t n = write(a->out_fd, out->buf + off, out->len - off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += n;
+    }
+    pthread_mutex_unlock(&a->out_lock);
+    out->len = 0;
+}
+
+static void report(struct audit *a, struct worker_out *out, int dirfd,
+                   const char *name, const char *path, size_t path_len) {
+    int rr = faccessat(dirfd, name, R_OK, 0) == 0;
+    int rw = faccessat(dirfd, name, W_OK, 0) == 0;
+    int er = rr, ew = rw;
+
+    // Same identity means same answer, skip the second pair of calls
+    if (!a->same_identity) {
+        er = faccessat(dirfd, name, R_OK, AT_EACCESS) == 0;
+        ew = faccessat(dirfd, name, W_OK, AT_EACCESS) == 0;
+    }
+    if (rr != er || rw != ew) {
+        atomic_fetch_add_explicit(&a->differ, 1, memory_order_relaxed);
+    }
+
+    if (out->len + path_len + 8 > OUT_BUF) {
+        flush_out(a, out);
+    }
+    if (path_len + 8 > OUT_BUF) {
+        return;
+    }
+    char *p = out->buf + out->len;
+    *p++ = rr ? 'r' : '-';
+    *p++ = rw ? 'w' : '-';
+    *p++ = ' ';
+    *p++ = er ? 'r' : '-';
+    *p++ = ew ? 'w' : '-';
+    *p++ = ' ';
+    memcpy(p, path, path_len);
+    p += path_len;
+    *p++ = '\n';
+    out->len = p - out->buf;
+}
+
+static struct dir_item *new_item(const char *path, size_t len, int fd) {
+    struct dir_item *item = malloc(sizeof(*item) + len + 1);
+    if (item == NULL) {
+        return NULL;
+    }
+    item->fd = fd;
+    memcpy(item->path, path, len);
+    item->path[len] = '\0';
+    return item;
+}
+
+static void scan_dir(struct audit *a, struct worker_out *out, struct dir_item *item, char *dents) {
+    int fd = item->fd;
+    if (fd == -1) {
+        fd = open(item->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "%s: %s\n", item->path, strerror(errno));
+            atomic_fetch_add_explicit(&a->errors, 1, memory_order_relaxed);
+            return;
+        }
+    } else {
+        atomic_fetch_sub_explicit(&a->open_dirs, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&a->dirs, 1, memory_order_relaxed);
+
+    size_t base_len = strlen(item->path);
+    size_t cap = base_len + 256;
+    char *path = malloc(cap);
+    struct dir_item *found = NULL, *last = NULL;
+    unsigned long files = 0;
+
+    if (path == NULL) {
+        close(fd);
+        return;
+    }
+    memcpy(path, item->path, base_len);
+    if (base_len == 0 || path[base_len - 1] != '/') {
+        path[base_len++] = '/';
+    }
+
+    while (1) {
+        long n = syscall(SYS_getdents64, fd, dents, DENTS_BUF);
+        if (n == -1) {
+            fprintf(stderr, "%s: %s\n", item->path, strerror(errno));
+            atomic_fetch_add_explicit(&a->errors, 1, memory_order_relaxed);
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t name_len = strlen(name);
+            if (base_len + name_len + 1 > cap) {
+                cap = (base_len + name_len + 1) * 2;
+                char *grown = realloc(path, cap);
+                if (grown == NULL) {
+                    continue;
+                }
+                path = grown;
+            }
+            memcpy(path + base_len, name, name_len);
+            files++;
+            report(a, out, fd, name, path, base_len + name_len);
+
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) {
+                    type = DT_DIR;
+                }
+            }
+            if (type != DT_DIR) {
+                continue;
+            }
+
+            // openat relative to the parent while the descriptor budget
+            // lasts, the subdirectory is reopened by path otherwise
+            int child = -1;
+            if (atomic_fetch_add_explicit(&a->open_dirs, 1, memory_order_relaxed) < MAX_OPEN_DIRS) {
+                child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (child == -1) {
+                atomic_fetch_sub_explicit(&a->open_dirs, 1, memory_order_relaxed);
+            }
+            struct dir_item *sub = new_item(path, base_len + name_len, child);
+            if (sub == NULL) {
+                if (child != -1) {
+                    close(child);
+                    atomic_fetch_sub_explicit(&a->open_dirs, 1, memory_order_relaxed);
+                }
+                continue;
+            }
+            sub->next = found;
+            found = sub;
+            if (last == NULL) {
+                last = sub;
+            }
+        }
+    }
+    close(fd);
+    free(path);
+    atomic_fetch_add_explicit(&a->files, files, memory_order_relaxed);
+
+    // Hand every subdirectory of this one to the pool in one splice
+    if (found != NULL) {
+        pthread_mutex_lock(&a->lock);
+        last->next = a->stack;
+        a->stack = found;
+        pthread_cond_broadcast(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+static void *audit_worker(void *arg) {
+    struct audit *a = arg;
+    struct worker_out *out = malloc(sizeof(*out));
+    char *dents = malloc(DENTS_BUF);
+
+    if (out == NULL || dents == NULL) {
+        free(out);
+        free(dents);
+        return NULL;
+    }
+    out->len = 0;
+
+    pthread_mutex_lock(&a->lock);
+    while (1) {
+        while (a->stack == NULL && a->active > 0) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        if (a->stack == NULL) {
+            // Nothing queued and nobody left to queue more: the walk is over
+            pthread_cond_broadcast(&a->cond);
+            break;
+        }
+        struct dir_item *item = a->stack;
+        a->stack = item->next;
+        a->active++;
+        pthread_mutex_unlock(&a->lock);
+
+        scan_dir(a, out, item, dents);
+        free(item);
+
+        pthread_mutex_lock(&a->lock);
+        a->active--;
+        if (a->stack == NULL && a->active == 0) {
+            pthread_cond_broadcast(&a->cond);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    flush_out(a, out);
+    free(out);
+    free(dents);
+    return NULL;
+}
+
+int access_audit(const char *root, int nthreads, int out_fd, struct access_audit_stats *stats) {
+    struct audit a;
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    int started = 0;
+
+    if (threads == NULL) {
+        return -1;
+    }
+    memset(&a, 0, sizeof(a));
+    pthread_mutex_init(&a.lock, NULL);
+    pthread_cond_init(&a.cond, NULL);
+    pthread_mutex_init(&a.out_lock, NULL);
+    a.out_fd = out_fd;
+    a.same_identity = getuid() == geteuid() && getgid() == getegid();
+
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        free(threads);
+        return -1;
+    }
+    struct worker_out *out = malloc(sizeof(*out));
+    if (out != NULL) {
+        out->len = 0;
+        report(&a, out, AT_FDCWD, root, root, strlen(root));
+        flush_out(&a, out);
+        free(out);
+    }
+    a.stack = new_item(root, strlen(root), fd);
+    if (a.stack == NULL) {
+        close(fd);
+        free(threads);
+        return -1;
+    }
+    a.stack->next = NULL;
+    atomic_store(&a.open_dirs, 1);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, audit_worker, &a) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        audit_worker(&a);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    stats->files = atomic_load(&a.files);
+    stats->dirs = atomic_load(&a.dirs);
+    stats->differ = atomic_load(&a.differ);
+    stats->errors = atomic_load(&a.errors);
+    pthread_mutex_destroy(&a.lock);
+    pthread_cond_destroy(&a.cond);
+    pthread_mutex_destroy(&a.out_lock);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef ACCESS_AUDIT_H
+#define ACCESS_AUDIT_H
+
+/*
+ * Non-destructive access audit. Walks a directory tree with openat() and
+ * getdents64() on a pool of threads and reports, for every entry, whether
+ * it is readable and writable for the real and for the effective identity.
+ * faccessat() answers both questions (with and without AT_EACCESS), so no
+ * file is opened, created or truncated along the way.
+ *
+ * Output is one line per entry, "<real> <effective> <path>" where each
+ * access column is "rw", "r-", "-w" or "--". Lines are streamed as
+ * workers fill their buffers, so their order follows the walk, not the
+ * sorted tree.
+ */
+
+struct access_audit_stats {
+    unsigned long files;
+    unsigned long dirs;
+    unsigned long differ;       // real and effective answers disagree
+    unsigned long errors;
+};
+
+int access_audit(const char *root, int nthreads, int out_fd, struct access_audit_stats *stats);
+
+#endif
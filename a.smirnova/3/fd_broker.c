@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "fd_broker.h"
+
+#define CACHE_SETS 256
+#define CACHE_WAYS 4
+
+/*
+ * Wire format, one datagram each way per batch:
+ *   request: u32 count, then count x { u8 mode, u16 length, path bytes }
+ *   reply:   u32 count, i32 errno per entry (0 = ok), SCM_RIGHTS with the
+ *            descriptors of the successful entries in order
+ */
+
+struct cache_entry {
+    char *path;
+    char mode;
+    int fd;
+};
+
+static struct cache_entry cache[CACHE_SETS][CACHE_WAYS];
+static unsigned cache_victim[CACHE_SETS];
+
+// Evicted descriptors may already be queued for the current reply, so they
+// are closed only after it has been sent
+static int evicted[FD_BROKER_MAX_BATCH];
+static int evicted_count = 0;
+
+static uint32_t hash_path(const char *path, size_t len, char mode) {
+    uint32_t h = 2166136261u ^ (unsigned char)mode;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int mode_flags(char mode) {
+    switch (mode) {
+    case 'r': return O_RDONLY;
+    case 'w': return O_WRONLY;
+    case 'a': return O_WRONLY | O_APPEND;
+    case '+': return O_RDWR;
+    default: return -1;
+    }
+}
+
+// Switch the filesystem UID and GID, which alone decide open()'s
+// permission checks; -1 if the kernel did not take them
+static int set_fs_ids(uid_t uid, gid_t gid) {
+    setfsgid(gid);
+    setfsuid(uid);
+    // Both calls return the previous value; an invalid id reads it back
+    if ((uid_t)setfsuid(-1) != uid || (gid_t)setfsgid(-1) != gid) {
+        return -1;
+    }
+    return 0;
+}
+
+// Open one path under the broker's policy; returns fd or -errno
+static int broker_open(const char *path, char mode, enum fd_broker_policy policy) {
+    int flags = mode_flags(mode);
+    if (flags == -1) {
+        return -EINVAL;
+    }
+    // O_NONBLOCK so a FIFO cannot stall the broker before the S_ISREG check
+    flags |= O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+
+    int fd;
+    if (policy == FD_BROKER_REAL) {
+        // Open as the real UID, like task3's second fopen after
+        // setuid(real_uid): the check and the open are one step, so the
+        // path cannot be swapped between them. No symlinks either.
+        if (set_fs_ids(getuid(), getgid()) == -1) {
+            set_fs_ids(geteuid(), getegid());
+            return -EPERM;
+        }
+        fd = open(path, flags | O_NOFOLLOW);
+        int saved = errno;
+        if (set_fs_ids(geteuid(), getegid()) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return -EPERM;
+        }
+        errno = saved;
+    } else {
+        fd = open(path, flags);
+    }
+    if (fd == -1) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -EPERM;
+    }
+    fcntl(fd, F_SETFL, flags & O_APPEND);
+    return fd;
+}
+
+static int cached_open(const char *path, size_t len, char mode,
+                       enum fd_broker_policy policy, struct fd_broker_stats *stats) {
+    uint32_t set = hash_path(path, len, mode) % CACHE_SETS;
+    struct cache_entry *e = NULL;
+
+    for (int way = 0; way < CACHE_WAYS; way++) {
+        struct cache_entry *c = &cache[set][way];
+        if (c->path == NULL) {
+            if (e == NULL) {
+                e = c;
+            }
+        } else if (c->mode == mode && strcmp(c->path, path) == 0) {
+            stats->cache_hits++;
+            return c->fd;
+        }
+    }
+    int fd = broker_open(path, mode, policy);
+    if (fd < 0) {
+        stats->denied++;
+        return fd;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return fd;
+    }
+    // A full set evicts its ways round-robin
+    if (e == NULL) {
+        e = &cache[set][cache_victim[set]++ % CACHE_WAYS];
+        evicted[evicted_count++] = e->fd;
+        free(e->path);
+    }
+    e->path = copy;
+    e->mode = mode;
+    e->fd = fd;
+    return fd;
+}
+
+static void cache_clear(void) {
+    for (int set = 0; set < CACHE_SETS; set++) {
+        for (int way = 0; way < CACHE_WAYS; way++) {
+            struct cache_entry *c = &cache[set][way];
+            if (c->path != NULL) {
+                close(c->fd);
+                free(c->path);
+                c->path = NULL;
+            }
+        }
+    }
+}
+
+static int send_reply(int sock, uint32_t count, const int32_t *errs, const int *fds, int nfds) {
+    char cbuf[CMSG_SPACE(sizeof(int) * FD_BROKER_MAX_BATCH)];
+    struct iovec iov[2] = {
+        { &count, sizeof(count) },
+        { (void *)errs, count * sizeof(*errs) },
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+    if (nfds > 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int fd_broker_serve(int sock, enum fd_broker_policy policy, struct fd_broker_stats *stats) {
+    int32_t errs[FD_BROKER_MAX_BATCH];
+    int fds[FD_BROKER_MAX_BATCH];
+    int rc = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    // The request and the path copied out of it
+    char *buf = malloc(2 * FD_BROKER_MAX_MESSAGE);
+    if (buf == NULL) {
+        return -1;
+    }
+    char *path = buf + FD_BROKER_MAX_MESSAGE;
+    while (1) {
+        ssize_t n = recv(sock, buf, FD_BROKER_MAX_MESSAGE, MSG_TRUNC);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            rc = 0;
+            break;
+        }
+        uint32_t count;
+        if (n < (ssize_t)sizeof(count) || (size_t)n > FD_BROKER_MAX_MESSAGE) {
+            errno = EPROTO;
+            break;
+        }
+        memcpy(&count, buf, sizeof(count));
+        if (count > FD_BROKER_MAX_BATCH) {
+            errno = EPROTO;
+            break;
+        }
+        stats->batches++;
+
+        size_t off = sizeof(count);
+        int nfds = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t len;
+            if (off + 3 > (size_t)n) {
+                errs[i] = EPROTO;
+                continue;
+            }
+            char mode = buf[off];
+            memcpy(&len, buf + off + 1, sizeof(len));
+            off += 3;
+            if (off + len > (size_t)n || len == 0 || memchr(buf + off, '\0', len) != NULL) {
+                errs[i] = EINVAL;
+                off += len;
+                continue;
+            }
+            memcpy(path, buf + off, len);
+            path[len] = '\0';
+            off += len;
+
+            stats->requests++;
+            int fd = cached_open(path, len, mode, policy, stats);
+            if (fd < 0) {
+                errs[i] = -fd;
+            } else {
+                errs[i] = 0;
+                fds[nfds++] = fd;
+            }
+        }
+        int sent = send_reply(sock, count, errs, fds, nfds);
+        while (evicted_count > 0) {
+            close(evicted[--evicted_count]);
+        }
+        if (sent == -1) {
+            break;
+        }
+    }
+    cache_clear();
+    free(buf);
+    return rc;
+}
+
+static int open_one_batch(int sock, char *buf, const char *const *paths, const char *modes,
+                          size_t n, int *fds, int *errs) {
+    uint32_t count = (uint32_t)n;
+    size_t off = sizeof(count);
+
+    memcpy(buf, &count, sizeof(count));
+    for (size_t i = 0; i < n; i++) {
+        uint16_t len = (uint16_t)strlen(paths[i]);
+        buf[off] = modes[i];
+        memcpy(buf + off + 1, &len, sizeof(len));
+        memcpy(buf + off + 3, paths[i], len);
+        off += 3 + len;
+    }
+    while (send(sock, buf, off, MSG_NOSIGNAL) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    int32_t reply_errs[FD_BROKER_MAX_BATCH];
+    char cbuf[CMSG_SPACE(sizeof(int) * FD_BROKER_MAX_BATCH)];
+    struct iovec iov[2] = {
+        { &count, sizeof(count) },
+        { reply_errs, sizeof(reply_errs) },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov, .msg_iovlen = 2,
+        .msg_control = cbuf, .msg_controllen = sizeof(cbuf),
+    };
+    ssize_t got;
+    while ((got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    // Collect the descriptors of every SCM_RIGHTS header first, so that
+    // whatever is not handed out below can be closed
+    int received[FD_BROKER_MAX_BATCH];
+    size_t nrecv = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t k = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t j = 0; j < k; j++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + j * sizeof(int), sizeof(int));
+            if (nrecv < FD_BROKER_MAX_BATCH) {
+                received[nrecv++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    // A truncated control message loses descriptors, and with them the
+    // order that maps the rest to requests
+    if ((msg.msg_flags & MSG_CTRUNC) || got < (ssize_t)sizeof(count) || count != n ||
+        (size_t)got < sizeof(count) + n * sizeof(int32_t)) {
+        for (size_t j = 0; j < nrecv; j++) {
+            close(received[j]);
+        }
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t next = 0;
+    for (size_t i = 0; i < n; i++) {
+        errs[i] = reply_errs[i];
+        fds[i] = -1;
+        if (reply_errs[i] == 0) {
+            if (next < nrecv) {
+                fds[i] = received[next++];
+            } else {
+                errs[i] = EPROTO;
+            }
+        }
+    }
+    while (next < nrecv) {
+        close(received[next++]);
+    }
+    return 0;
+}
+
+// One round trip at a time: replies are matched to requests by order, so
+// two threads sending on the same socket must not interleave
+static pthread_mutex_t round_trip = PTHREAD_MUTEX_INITIALIZER;
+
+int fd_broker_open_batch(int sock, const char *const *paths, const char *modes,
+                         size_t n, int *fds, int *errs) {
+    size_t start = 0;
+    int rc = 0;
+
+    char *buf = malloc(FD_BROKER_MAX_MESSAGE);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    while (start < n) {
+        // Cut the batch at the descriptor limit or the message size
+        size_t end = start, bytes = sizeof(uint32_t);
+        while (end < n && end - start < FD_BROKER_MAX_BATCH) {
+            size_t len = strlen(paths[end]);
+            if (len == 0 || len > UINT16_MAX || bytes + 3 + len > FD_BROKER_MAX_MESSAGE) {
+                break;
+            }
+            bytes += 3 + len;
+            end++;
+        }
+        if (end == start) {
+            // A path that can never fit in a request
+            fds[start] = -1;
+            errs[start] = paths[start][0] == '\0' ? ENOENT : ENAMETOOLONG;
+            start++;
+            continue;
+        }
+        pthread_mutex_lock(&round_trip);
+        rc = open_one_batch(sock, buf, paths + start, modes + start, end - start,
+                            fds + start, errs + start);
+        pthread_mutex_unlock(&round_trip);
+        if (rc == -1) {
+            break;
+        }
+        start = end;
+    }
+    free(buf);
+    return rc;
+}
@@ -0,0 +1,47 @@
+#ifndef FD_BROKER_H
+#define FD_BROKER_H
+
+#include <stddef.h>
+
+/*
+ * File-descriptor broker. A privileged process serves open requests from
+ * an unprivileged worker over a SOCK_SEQPACKET Unix socket and passes the
+ * descriptors back with SCM_RIGHTS. Requests are batched (one round trip
+ * per batch) and the broker keeps the descriptors it opened in a small
+ * cache keyed by path and mode.
+ *
+ * A cached descriptor is shared: every copy handed out refers to the same
+ * open file description, so workers should use pread/pwrite rather than
+ * rely on the file offset.
+ */
+
+#define FD_BROKER_MAX_BATCH 128
+#define FD_BROKER_MAX_MESSAGE 65536
+
+// Whose permissions decide a request, the two steps of task3
+enum fd_broker_policy {
+    FD_BROKER_EFFECTIVE,        // open as the broker's effective UID
+    FD_BROKER_REAL              // open as the real UID, final symlinks refused
+};
+
+struct fd_broker_stats {
+    unsigned long batches;
+    unsigned long requests;
+    unsigned long cache_hits;
+    unsigned long denied;
+};
+
+// Serve requests until the worker closes its end; 0 on a clean shutdown.
+// The descriptor cache is per process, so run one server at a time.
+int fd_broker_serve(int sock, enum fd_broker_policy policy, struct fd_broker_stats *stats);
+
+/*
+ * Open paths[i] with modes[i] ('r', 'w', 'a' or '+' for read-write; never
+ * creates or truncates). fds[i] gets a descriptor or -1 with errs[i] set to
+ * the errno from the broker. Returns -1 if the broker could not be reached.
+ * Threads may share sock: their round trips are serialized.
+ */
+int fd_broker_open_batch(int sock, const char *const *paths, const char *modes,
+                         size_t n, int *fds, int *errs);
+
+#endif
@@ -1,13 +1,171 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "access_audit.h"
+#include "fd_broker.h"
+
+void print_usage(const char *progname) {
+    printf("Usage: %s <filename>\n", progname);
+    printf("       %s -b [-R] [-m r|w|a|+] <filename>...\n", progname);
+    printf("  -b    Open the files through a broker process that keeps the\n");
+    printf("        effective UID while this process runs as the real UID\n");
+    printf("  -R    Broker only grants what the real UID may open as well\n");
+    printf("  -m    Open mode (default w, never creates or truncates)\n");
+    printf("       %s -a [-j threads] <directory>\n", progname);
+    printf("  -a    Report read/write access of every file in the tree for the\n");
+    printf("        real and the effective UID (\"<real> <effective> <path>\")\n");
+    printf("  -j    Number of walker threads (default: online CPUs)\n");
+}
+
+int run_audit(const char *root, int nthreads) {
+    struct access_audit_stats stats;
+    struct timespec start, end;
+
+    printf("Real UID: %d\n", getuid());
+    printf("Effective UID: %d\n", geteuid());
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (access_audit(root, nthreads, STDOUT_FILENO, &stats) == -1) {
+        perror(root);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "Audited %lu entries in %lu directories in %.3f s, %lu differ between real and effective UID, %lu errors\n",
+            stats.files + 1, stats.dirs,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+            stats.differ, stats.errors);
+    return stats.errors == 0 ? 0 : 1;
+}
+
+void print_open_results(char **files, int n, const int *fds, const int *errs) {
+    for (int i = 0; i < n; i++) {
+        if (fds[i] == -1) {
+            printf("%s: %s\n", files[i], strerror(errs[i]));
+        } else {
+            printf("%s: received fd %d\n", files[i], fds[i]);
+            close(fds[i]);
+        }
+    }
+}
+
+// Privileged opens happen in a forked broker that keeps the effective UID;
+// this process drops to the real UID for good and gets descriptors back
+// over the socket, one round trip per batch
+int run_broker(char **files, int n, char mode, enum fd_broker_policy policy) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        struct fd_broker_stats stats;
+        close(sv[0]);
+        int rc = fd_broker_serve(sv[1], policy, &stats);
+        if (rc == -1) {
+            perror("Broker failed");
+        }
+        fprintf(stderr, "Broker: %lu batches, %lu requests, %lu cache hits, %lu denied\n",
+                stats.batches, stats.requests, stats.cache_hits, stats.denied);
+        _exit(rc == 0 ? 0 : 1);
+    }
+    close(sv[1]);
+
+    uid_t real_uid = getuid();
+    if (setresuid(real_uid, real_uid, real_uid) == -1) {
+        perror("setresuid");
+        return 1;
+    }
+    printf("Worker Real UID: %d\n", getuid());
+    printf("Worker Effective UID: %d\n", geteuid());
+
+    int *fds = malloc(n * sizeof(int));
+    int *errs = malloc(n * sizeof(int));
+    char *modes = malloc(n);
+    if (fds == NULL || errs == NULL || modes == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(modes, mode, n);
+
+    // Second pass is served from the broker's descriptor cache
+    int rc = 0;
+    for (int pass = 1; pass <= 2 && rc == 0; pass++) {
+        printf("\nBatch %d:\n", pass);
+        if (fd_broker_open_batch(sv[0], (const char *const *)files, modes, n, fds, errs) == -1) {
+            perror("Broker request failed");
+            rc = 1;
+            break;
+        }
+        print_open_results(files, n, fds, errs);
+    }
+    fflush(stdout);
+
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    free(fds);
+    free(errs);
+    free(modes);
+    return rc;
+}
 
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && argv[1][0] == '-') {
+        int opt, broker = 0, audit = 0;
+        long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        char mode = 'w';
+        enum fd_broker_policy policy = FD_BROKER_EFFECTIVE;
+
+        while ((opt = getopt(argc, argv, "bRm:aj:")) != -1) {
+            switch (opt) {
+            case 'b':
+                broker = 1;
+                break;
+            case 'R':
+                policy = FD_BROKER_REAL;
+                break;
+            case 'm':
+                mode = optarg[0];
+                break;
+            case 'a':
+                audit = 1;
+                break;
+            case 'j':
+                nthreads = atol(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        if (audit && optind + 1 == argc) {
+            return run_audit(argv[optind], nthreads > 0 ? (int)nthreads : 1);
+        }
+        if (!broker || optind == argc || strchr("rwa+", mode) == NULL) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_broker(argv + optind, argc - optind, mode, policy);
+    }
+
     if (argc != 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
+        print_usage(argv[0]);
         return 1;
     }
     
@@ -46,6 +204,9 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+// gcc -pthread task3.c fd_broker.c access_audit.c -o task3
 // ls -l file.txt
 // chmod u+s task3.exe
-// ls -l task3.exe
\ No newline at end of file
+// ls -l task3.exe
+// ./task3 -b file.txt /etc/shadow missing.txt
+// ./task3 -a /home > access.txt
\ No newline at end of file
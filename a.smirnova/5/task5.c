@@ -4,94 +4,34 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
-typedef struct {
-    long offset;
-    int length;
-} LineInfo;
-
-// Global variables for storing line information
-LineInfo *line_table = NULL;
-int total_lines = 0;
-int table_capacity = 0;
-
-int expand_table() {
-    int new_capacity = table_capacity == 0 ? 10 : table_capacity * 2;
-    LineInfo *new_table = realloc(line_table, new_capacity * sizeof(LineInfo));
-    if (new_table == NULL) {
-        perror("realloc");
-        return -1;
-    }
-    line_table = new_table;
-    table_capacity = new_capacity;
-    return 0;
-}
+#include "../lineindex/line_index.h"
+#include "../lineindex/line_query.h"
 
-int add_line(long offset, int length) {
-    if (total_lines >= table_capacity) {
-        if (expand_table() == -1) {
-            return -1;
-        }
-    }
-    
-    line_table[total_lines].offset = offset;
-    line_table[total_lines].length = length;
-    total_lines++;
-    return 0;
-}
+#define BENCH_LINE_CAP 512
+
+// Line table of the open file
+Array line_table;
 
 int build_line_table(int fd) {
-    char buffer[1];
-    long current_offset = 0;
-    int line_start = 0;
-    int line_length = 0;
-    
     printf("Building line table...\n");
-    
-    // Move to the beginning of the file
-    if (lseek(fd, 0L, SEEK_SET) == -1) {
-        perror("lseek");
+
+    if (initArray(&line_table) == -1 || build_line_table_fd(fd, &line_table) == -1) {
         return -1;
     }
-    
-    while (read(fd, buffer, 1) > 0) {
-        if (buffer[0] == '\n') {
-            // Found newline character
-            if (add_line(line_start, line_length) == -1) {
-                return -1;
-            }
-            line_start = current_offset + 1;
-            line_length = 0;
-        } else {
-            line_length++;
-        }
-        current_offset++;
-    }
-    
-    // Handle the last line if the file doesn't end with \n
-    if (line_length > 0) {
-        if (add_line(line_start, line_length) == -1) {
-            return -1;
-        }
-    }
-    
-    printf("Total lines in file: %d\n", total_lines);
+
+    printf("Total lines in file: %zu\n", line_table.cnt);
     return 0;
 }
 
 int read_line(int fd, int line_number, char **buffer, int *buffer_size) {
-    if (line_number < 0 || line_number >= total_lines) {
-        return -1;
-    }
-    
-    // Move to the beginning of the line
-    if (lseek(fd, line_table[line_number].offset, SEEK_SET) == -1) {
-        perror("lseek");
+    if (line_number < 0 || (size_t)line_number >= line_table.cnt) {
         return -1;
     }
     
     // Allocate memory for the line
-    int line_length = line_table[line_number].length;
+    int line_length = line_table.array[line_number].length;
     *buffer_size = line_length + 1;
     *buffer = malloc(*buffer_size);
     if (*buffer == NULL) {
@@ -99,10 +39,11 @@ int read_line(int fd, int line_number, char **buffer, int *buffer_size) {
         return -1;
     }
     
-    // Read the line
-    int bytes_read = read(fd, *buffer, line_length);
+    // Read the line with pread, so the shared file offset is never moved
+    // and concurrent readers cannot race on it
+    int bytes_read = line_pread(fd, *buffer, line_length, line_table.array[line_number].offset);
     if (bytes_read == -1) {
-        perror("read");
+        perror("pread");
         free(*buffer);
         return -1;
     }
@@ -116,20 +57,112 @@ void print_debug_table() {
     printf("Line Number | Offset | Length\n");
     printf("------------|--------|-------\n");
     
-    for (int i = 0; i < total_lines; i++) {
-        printf("%11d | %6ld | %4d\n", 
-               i + 1, line_table[i].offset, line_table[i].length);
+    for (size_t i = 0; i < line_table.cnt; i++) {
+        printf("%11zu | %6ld | %4ld\n", 
+               i + 1, (long)line_table.array[i].offset, (long)line_table.array[i].length);
     }
     printf("========================\n\n");
 }
 
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Random lookups through the worker pool with 1..max_threads threads, once
+// with the file in the page cache and once after dropping it
+int run_benchmark(int fd, int max_threads, size_t queries) {
+    LineQuery query;
+    LineRequest *requests = malloc(queries * sizeof(LineRequest));
+    char *buffers = malloc(queries * BENCH_LINE_CAP);
+    unsigned long long seed = 88172645463325252ULL;
+
+    if (requests == NULL || buffers == NULL) {
+        perror("malloc");
+        free(requests);
+        free(buffers);
+        return -1;
+    }
+    line_query_init(&query, fd, NULL, &line_table);
+    for (size_t i = 0; i < queries; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        requests[i].line = line_table.cnt > 0 ? seed % line_table.cnt : 0;
+        requests[i].buf = buffers + i * BENCH_LINE_CAP;
+        requests[i].cap = BENCH_LINE_CAP;
+    }
+
+    printf("Benchmark: %zu random lookups over %zu lines with pread\n", queries, line_table.cnt);
+    printf("cache | threads |       ms | lookups/s | speedup\n");
+    printf("------|---------|----------|-----------|--------\n");
+    for (int cold = 0; cold <= 1; cold++) {
+        double base = 0;
+        for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+            LinePool *pool = line_pool_create(&query, threads - 1);
+            if (pool == NULL) {
+                free(requests);
+                free(buffers);
+                return -1;
+            }
+            if (cold) {
+                // Only clean pages are dropped, which is all a reader has
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            } else {
+                line_pool_run(pool, requests, queries);
+            }
+            double start = now_ms();
+            line_pool_run(pool, requests, queries);
+            double ms = now_ms() - start;
+            line_pool_destroy(pool);
+
+            size_t failed = 0;
+            for (size_t i = 0; i < queries; i++) {
+                failed += requests[i].length == -1;
+            }
+            if (threads == 1) {
+                base = ms;
+            }
+            printf("%-5s | %7d | %8.1f | %9.0f | %6.2fx%s\n", cold ? "cold" : "hot", threads, ms,
+                   queries / (ms / 1000.0), base / ms, failed ? " (errors)" : "");
+            if (threads == max_threads) {
+                break;
+            }
+        }
+    }
+    free(requests);
+    free(buffers);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
+    int benchmark = 0, max_threads = 4;
+    size_t queries = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bj:q:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark = 1;
+            break;
+        case 'j':
+            max_threads = atoi(optarg);
+            break;
+        case 'q':
+            queries = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1 || max_threads < 1 || queries == 0) {
+        printf("Usage: %s [-b [-j threads] [-q lookups]] <filename>\n", argv[0]);
         exit(1);
     }
     
-    char *filename = argv[1];
+    char *filename = argv[optind];
     int fd;
     
     // Open the file
@@ -147,6 +180,13 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
+    if (benchmark) {
+        int rc = run_benchmark(fd, max_threads, queries);
+        freeArray(&line_table);
+        close(fd);
+        return rc == -1 ? 1 : 0;
+    }
+
     // Print debug table
     print_debug_table();
     
@@ -172,8 +212,8 @@ int main(int argc, char *argv[]) {
             break;
         }
         
-        if (line_number > total_lines) {
-            printf("Error: line number must be from 1 to %d\n", total_lines);
+        if (line_number < 0 || (size_t)line_number > line_table.cnt) {
+            printf("Error: line number must be from 1 to %zu\n", line_table.cnt);
             continue;
         }
         
@@ -192,7 +232,9 @@ int main(int argc, char *argv[]) {
     }
     
     // Free table memory
-    free(line_table);
+    freeArray(&line_table);
     close(fd);
     return 0;
-}
\ No newline at end of file
+}
+
+// gcc -pthread task5.c ../lineindex/line_index.c ../lineindex/line_query.c -o line_reader
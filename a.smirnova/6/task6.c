@@ -3,39 +3,11 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <signal.h>
+#include <stdint.h>
 #include <string.h>
 
-typedef struct {
-    off_t offset;
-    off_t length;
-} Line;
-
-typedef struct {
-    Line* array;
-    int cnt;
-    int cap;
-} Array;
-
-void initArray(Array* a) {
-    a->array = malloc(sizeof(Line));
-    a->cnt = 0;
-    a->cap = 1;
-}
-
-void insertArray(Array* a, Line element) {
-    if (a->cnt == a->cap) {
-        a->cap *= 2;
-        a->array = realloc(a->array, a->cap * sizeof(Line));
-    }
-
-    a->array[a->cnt++] = element;
-}
-
-void freeArray(Array* a) {
-    free(a->array);
-    a->array = NULL;
-    a->cnt = a->cap = 0;
-}
+#include "../lineindex/line_index.h"
+#include "../lineindex/line_query.h"
 
 // Global variables for timeout handling
 static int timeout_occurred = 0;
@@ -68,14 +40,114 @@ void timeout_handler(int sig) {
     }
 }
 
+// Print a line from the file with pread, leaving the file offset alone
+static int print_line(int fd, Line line) {
+    char* buf = malloc(line.length + 1);
+
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    if (line_pread(fd, buf, line.length, line.offset) != line.length) {
+        perror("Error reading line");
+        free(buf);
+        return -1;
+    }
+    buf[line.length] = '\n';
+    fwrite(buf, 1, line.length + 1, stdout);
+    free(buf);
+    return 0;
+}
+
+// Print the last count records (SIZE_MAX: all of them), last first with
+// reverse. '\n' lines are found by reading only the blocks at the end of
+// the file that hold them; other record formats need the full forward scan.
+static int print_tail(const char* path, const RecordFormat* format, size_t count, int reverse) {
+    Array table;
+    LineReverse r;
+    Line line;
+    int rc = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return 1;
+    }
+    if (reverse && format->kind == RECORD_NEWLINE) {
+        if (line_reverse_fd(&r, fd) == -1) {
+            close(fd);
+            return 1;
+        }
+        for (size_t n = 0; n < count && (rc = line_reverse_next(&r, &line)) == 1; n++) {
+            if (print_line(fd, line) == -1) {
+                rc = -1;
+                break;
+            }
+        }
+        line_reverse_close(&r);
+        close(fd);
+        return rc == -1 ? 1 : 0;
+    }
+
+    if (initArray(&table) == -1) {
+        close(fd);
+        return 1;
+    }
+    if (format->kind == RECORD_NEWLINE) {
+        rc = build_line_suffix_fd(fd, count, &table);
+    } else {
+        rc = build_record_table_fd(fd, format, &table);
+    }
+    size_t first = table.cnt > count ? table.cnt - count : 0;
+    for (size_t i = first; rc == 0 && i < table.cnt; i++) {
+        rc = print_line(fd, table.array[reverse ? table.cnt - 1 - (i - first) : i]);
+    }
+    freeArray(&table);
+    close(fd);
+    return rc == -1 ? 1 : 0;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) { 
-        return 1; 
+    RecordFormat format = RECORD_FORMAT_NEWLINE;
+    long tail_count = -1;
+    int reverse = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:rF:")) != -1) {
+        switch (opt) {
+        case 'F':
+            if (record_format_parse(&format, optarg) == -1) {
+                fprintf(stderr, "Unknown record format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            tail_count = atol(optarg);
+            if (tail_count < 0) {
+                tail_count = 0;
+            }
+            break;
+        case 'r':
+            reverse = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-F lf|crlf|nul|csv|fixed:N|sep:STR] [-n lines] [-r] file\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        return 1;
+    }
+    char* path = argv[optind];
+
+    if (tail_count >= 0 || reverse) {
+        return print_tail(path, &format, tail_count >= 0 ? (size_t)tail_count : SIZE_MAX, reverse);
     }
-    char* path = argv[1];
 
     Array table;
-    initArray(&table);
+    if (initArray(&table) == -1) {
+        return 1;
+    }
 
     int fd = open(path, O_RDONLY);
     if (fd == -1) {
@@ -92,35 +164,20 @@ int main(int argc, char* argv[]) {
     off_t current_pos = lseek(fd, 0L, SEEK_CUR);
     printf("Starting file analysis at position: %ld\n", current_pos);
 
-    char c;
-    off_t lineOffset = 0; //Offset of the line in the file
-    off_t lineLength = 0; 
-    while (read(fd, &c, 1) == 1) {
-        if (c == '\n') {
-            Line current = { lineOffset, lineLength };
-            insertArray(&table, current);
-
-            lineOffset += lineLength + 1;
-            lineLength = 0;
-        }
-        else {
-            lineLength++;
-        }
-    }
-
-    if (lineLength > 0) {
-        Line current = { lineOffset, lineLength };
-        insertArray(&table, current);
+    if (build_record_table_fd(fd, &format, &table) == -1) {
+        close(fd);
+        freeArray(&table);
+        return 1;
     }
 
     // Print debugging table as mentioned in comments
     printf("\nLine Table (for debugging):\n");
     printf(" Line | Offset | Length\n");
     printf("------|--------|-------\n");
-    for (int i = 0; i < table.cnt; i++) {
-        printf("%5d | %6ld | %6ld\n", i + 1, table.array[i].offset, table.array[i].length);
+    for (size_t i = 0; i < table.cnt; i++) {
+        printf("%5zu | %6ld | %6ld\n", i + 1, (long)table.array[i].offset, (long)table.array[i].length);
     }
-    printf("\nTotal lines: %d\n\n", table.cnt);
+    printf("\nTotal lines: %zu\n\n", table.cnt);
 
     // Set alarm for 5 seconds (only for the first prompt)
     printf("You have 5 seconds to enter a line number. If no input, entire file will be printed.\n");
@@ -175,8 +232,8 @@ int main(int argc, char* argv[]) {
         }
 
         if (num == 0) { break; }
-        if (table.cnt < num) {
-            printf("The file contains only %d line(s).\n", table.cnt);
+        if (table.cnt < (size_t)num) {
+            printf("The file contains only %zu line(s).\n", table.cnt);
             // No more alarm after the first valid input
             continue;
         }
@@ -184,14 +241,8 @@ int main(int argc, char* argv[]) {
         Line line = table.array[num - 1]; //Line
         char* buf = calloc(line.length + 1, sizeof(char)); //Buffer
 
-        if (lseek(fd, line.offset, SEEK_SET) == -1) {
-            perror("Error seeking in file");
-            free(buf);
-            // No more alarm after the first valid input
-            continue;
-        }
-        
-        if (read(fd, buf, line.length) == -1) {
+        // pread takes its own offset, the shared one stays put
+        if (line_pread(fd, buf, line.length, line.offset) == -1) {
             perror("Error reading line");
             free(buf);
             // No more alarm after the first valid input
@@ -208,4 +259,6 @@ int main(int argc, char* argv[]) {
     freeArray(&table);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// gcc -pthread task6.c ../lineindex/line_index.c ../lineindex/line_query.c -o line_reader
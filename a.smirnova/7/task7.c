@@ -1,43 +1,20 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
-typedef struct {
-    off_t offset;
-    off_t length;
-} Line;
-
-typedef struct {
-    Line* array;
-    int cnt;
-    int cap;
-} Array;
-
-void initArray(Array* a) {
-    a->array = malloc(sizeof(Line));
-    a->cnt = 0;
-    a->cap = 1;
-}
-
-void insertArray(Array* a, Line element) {
-    if (a->cnt == a->cap) {
-        a->cap *= 2;
-        a->array = realloc(a->array, a->cap * sizeof(Line));
-    }
-
-    a->array[a->cnt++] = element;
-}
-
-void freeArray(Array* a) {
-    free(a->array);
-    a->array = NULL;
-    a->cnt = a->cap = 0;
-}
+#include "../lineindex/line_index.h"
+#include "../lineindex/line_cut.h"
+#include "../lineindex/line_diff.h"
+#include "../lineindex/line_store.h"
+#include "../lineindex/line_sort.h"
+#include "../lineindex/word_index.h"
 
 // Global variables for timeout handling and memory mapping
 static int timeout_occurred = 0;
@@ -61,7 +38,8 @@ void timeout_handler(int sig) {
         printf("\n==========================================\n");
         printf("Program finished due to timeout.\n");
         
-        // Clean up and exit
+        // Clean up and exit, once a -i sidecar save is done with the mapping
+        line_store_wait();
         if (mapped_file != NULL) {
             munmap(mapped_file, file_size);
         }
@@ -71,14 +49,361 @@ void timeout_handler(int sig) {
     }
 }
 
+// Print the last count records (SIZE_MAX: all of them), last first with
+// reverse, straight from the mapping. '\n' lines are found backwards from
+// EOF without indexing the rest of the file; other record formats need the
+// full forward scan.
+static int print_tail(const char* path, const RecordFormat* format, size_t count, int reverse) {
+    LineIndex idx;
+    LineReverse r;
+    Line line;
+    int rc;
+
+    if (line_index_map(&idx, path) == -1) {
+        perror(path);
+        return 1;
+    }
+    if (reverse && format->kind == RECORD_NEWLINE) {
+        line_reverse_mem(&r, idx.data, idx.size);
+        for (size_t n = 0; n < count && line_reverse_next(&r, &line) == 1; n++) {
+            fwrite(idx.data + line.offset, 1, line.length, stdout);
+            putchar('\n');
+        }
+        line_index_close(&idx);
+        return 0;
+    }
+
+    if (format->kind == RECORD_NEWLINE) {
+        rc = build_line_suffix_mem(idx.data, idx.size, count, &idx.lines);
+    } else {
+        rc = build_record_table_mem(idx.data, idx.size, format, &idx.lines);
+    }
+    if (rc == -1) {
+        line_index_close(&idx);
+        return 1;
+    }
+    size_t first = idx.lines.cnt > count ? idx.lines.cnt - count : 0;
+    for (size_t i = first; i < idx.lines.cnt; i++) {
+        line = idx.lines.array[reverse ? idx.lines.cnt - 1 - (i - first) : i];
+        fwrite(idx.data + line.offset, 1, line.length, stdout);
+        putchar('\n');
+    }
+    line_index_close(&idx);
+    return 0;
+}
+
+// Print every line containing word, found through path.widx; the index is
+// built first if it is missing or older than the file
+static int print_word(const char* path, const char* word) {
+    LineIndex idx;
+    WordIndex words;
+    WordPostings postings;
+    struct timespec start, end;
+    size_t line, terms, matches = 0;
+    off_t offset;
+
+    if (line_index_map(&idx, path) == -1) {
+        perror(path);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (word_index_open(&words, path, idx.fd) == -1) {
+        fprintf(stderr, "Building word index %s.widx\n", path);
+        if (word_index_build(path, idx.fd, idx.data, idx.size, &idx.lines, &terms) == -1 ||
+            word_index_open(&words, path, idx.fd) == -1) {
+            perror("word index");
+            line_index_close(&idx);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    int found = word_index_find(&words, word, &postings);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    while (found && word_postings_next(&postings, &line, &offset) == 1 && (size_t)offset <= idx.size) {
+        const char* text = idx.data + offset;
+        const char* nl = memchr(text, '\n', idx.size - offset);
+        size_t len = nl != NULL ? (size_t)(nl - text) : idx.size - offset;
+        printf("Line %zu: ", line + 1);
+        fwrite(text, 1, len, stdout);
+        printf("\n");
+        matches++;
+    }
+    fprintf(stderr, "%zu matching line(s), lookup took %.1f us\n", matches,
+            (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3);
+    word_index_close(&words);
+    line_index_close(&idx);
+    return 0;
+}
+
+// Write the records of the file in sorted order; only the index entries
+// are sorted, the lines are copied out of the mapping at the end
+static int sort_lines(const char* path, const RecordFormat* format, const SortOptions* sort) {
+    static char out_buffer[1 << 20];
+    LineIndex idx;
+    int rc;
+
+    if (line_index_map(&idx, path) == -1) {
+        perror(path);
+        return 1;
+    }
+    if (build_record_table_mem(idx.data, idx.size, format, &idx.lines) == -1) {
+        line_index_close(&idx);
+        return 1;
+    }
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+    rc = line_sort(idx.data, &idx.lines, sort, stdout);
+    if (fflush(stdout) != 0) {
+        rc = -1;
+    }
+    line_index_close(&idx);
+    return rc == -1 ? 1 : 0;
+}
+
+// Write lines first..last (1-based) of the file, or just the fields of
+// them that cut selects
+static int cut_lines(const char* path, const RecordFormat* format, const CutSpec* cut,
+                     size_t first, size_t last) {
+    static char out_buffer[1 << 20];
+    LineIndex idx;
+    int rc = 0;
+
+    if (line_index_map(&idx, path) == -1) {
+        perror(path);
+        return 1;
+    }
+    if (build_record_table_mem(idx.data, idx.size, format, &idx.lines) == -1) {
+        line_index_close(&idx);
+        return 1;
+    }
+    if (last > idx.lines.cnt) {
+        last = idx.lines.cnt;
+    }
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+    if (first <= last) {
+        const Line* lines = idx.lines.array + first - 1;
+        size_t count = last - first + 1;
+        if (cut != NULL) {
+            rc = line_cut(idx.data, lines, count, cut, stdout);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                fwrite(idx.data + lines[i].offset, 1, lines[i].length, stdout);
+                putchar('\n');
+            }
+        }
+    }
+    if (fflush(stdout) != 0) {
+        rc = -1;
+    }
+    line_index_close(&idx);
+    return rc == -1 ? 1 : 0;
+}
+
+// "path<TAB>mtime" the way diff -u labels its files
+static void diff_label(const char* path, int fd, char* label, size_t cap) {
+    struct stat st;
+    struct tm tm;
+    char date[64] = "";
+
+    if (fstat(fd, &st) == 0 && localtime_r(&st.st_mtime, &tm) != NULL) {
+        char zone[16];
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        strftime(zone, sizeof(zone), "%z", &tm);
+        snprintf(date + strlen(date), sizeof(date) - strlen(date), ".%09ld %s",
+                 (long)st.st_mtim.tv_nsec, zone);
+    }
+    snprintf(label, cap, "%s\t%s", path, date);
+}
+
+// Compare two files line by line; exit status 0 if they are the same,
+// 1 if they differ and 2 on trouble, like diff
+static int diff_files(const char* path_a, const char* path_b, const RecordFormat* format,
+                      const DiffOptions* opt) {
+    static char out_buffer[1 << 20];
+    LineIndex idx[2];
+    DiffFile files[2];
+    char labels[2][PATH_MAX + 64];
+    const char* paths[2] = { path_a, path_b };
+    int rc = -1;
+    int opened = 0;
+
+    for (; opened < 2; opened++) {
+        LineIndex* x = &idx[opened];
+        if (line_index_map(x, paths[opened]) == -1) {
+            perror(paths[opened]);
+            goto done;
+        }
+        if (build_record_table_mem(x->data, x->size, format, &x->lines) == -1) {
+            line_index_close(x);
+            goto done;
+        }
+        diff_label(paths[opened], x->fd, labels[opened], sizeof(labels[opened]));
+        files[opened].data = x->data;
+        files[opened].lines = &x->lines;
+        files[opened].incomplete = format->kind == RECORD_NEWLINE && x->size > 0 &&
+                                   x->data[x->size - 1] != '\n';
+        files[opened].label = labels[opened];
+    }
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+    rc = line_diff(&files[0], &files[1], opt, stdout);
+    if (fflush(stdout) != 0) {
+        rc = -1;
+    }
+
+done:
+    while (opened > 0) {
+        line_index_close(&idx[--opened]);
+    }
+    return rc == -1 ? 2 : rc;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-F lf|crlf|nul|csv|fixed:N|sep:STR] [-i | -W] file\n"
+                    "       %s [-F format] [-n lines] [-r] file\n"
+                    "       %s -w word file\n"
+                    "       %s [-F format] -s [-r] [-N] [-k field] [-d delim] [-m MB] [-j threads] file\n"
+                    "       %s [-F format] [-f fields] [-d delim] [-l first-last] file\n"
+                    "       %s [-F format] [-u] [-j threads] -D other file\n",
+            prog, prog, prog, prog, prog, prog);
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 2) { 
-        return 1; 
+    RecordFormat format = RECORD_FORMAT_NEWLINE;
+    long tail_count = -1;
+    int reverse = 0;
+    int incremental = 0;
+    int build_words = 0;
+    const char* word = NULL;
+    SortOptions sort = SORT_OPTIONS_DEFAULT;
+    int sorting = 0;
+    const char* fields = NULL;
+    size_t first = 1, last = SIZE_MAX;
+    int ranged = 0;
+    const char* other = NULL;
+    DiffOptions diff = DIFF_OPTIONS_DEFAULT;
+    char delim = 0;             // -d, for the sort key or the cut fields
+    int threads = 0;            // -j, for the sort or the diff
+    int sort_only = 0;          // -N, -k or -m seen
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:rF:iWw:sNk:d:m:j:f:l:D:u")) != -1) {
+        switch (opt) {
+        case 'F':
+            if (record_format_parse(&format, optarg) == -1) {
+                fprintf(stderr, "Unknown record format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            tail_count = atol(optarg);
+            if (tail_count < 0) {
+                tail_count = 0;
+            }
+            break;
+        case 'r':
+            reverse = 1;
+            break;
+        case 'i':
+            incremental = 1;
+            break;
+        case 'W':
+            build_words = 1;
+            break;
+        case 'w':
+            word = optarg;
+            break;
+        case 's':
+            sorting = 1;
+            break;
+        case 'N':
+            sort.kind = SORT_NUMERIC;
+            sort_only = 1;
+            break;
+        case 'k':
+            sort.field = atoi(optarg);
+            sort_only = 1;
+            break;
+        case 'd':
+            delim = strcmp(optarg, "\\t") == 0 ? '\t' : optarg[0];
+            break;
+        case 'm':
+            sort.memory = (size_t)atol(optarg) << 20;
+            sort_only = 1;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                threads = 1;
+            }
+            break;
+        case 'f':
+            fields = optarg;
+            break;
+        case 'l':
+            if (line_range_parse(optarg, &first, &last) == -1) {
+                fprintf(stderr, "Bad line range: %s\n", optarg);
+                return 1;
+            }
+            ranged = 1;
+            break;
+        case 'D':
+            other = optarg;
+            break;
+        case 'u':
+            diff.unified = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // One mode per run; -r goes with -s when sorting, else it is the tail
+    int tail = tail_count >= 0 || (reverse && !sorting);
+    int modes = (word != NULL) + (other != NULL) + (fields != NULL || ranged) + sorting + tail +
+                (incremental || build_words);
+    if (optind != argc - 1 || modes > 1 || (incremental && build_words) ||
+        (sort_only && !sorting) || (diff.unified && other == NULL) ||
+        (threads != 0 && !sorting && other == NULL) ||
+        (delim != 0 && !sorting && fields == NULL)) {
+        usage(argv[0]);
+        return 1;
+    }
+    char* path = argv[optind];
+
+    if ((incremental || build_words || word != NULL) && format.kind != RECORD_NEWLINE) {
+        fprintf(stderr, "-i, -W and -w index '\\n' lines only\n");
+        return 1;
+    }
+    if (word != NULL) {
+        return print_word(path, word);
+    }
+    if (other != NULL) {
+        diff.threads = threads > 0 ? threads : 1;
+        return diff_files(other, path, &format, &diff);
+    }
+    if (fields != NULL || ranged) {
+        CutSpec cut;
+        // cut splits on tabs unless told otherwise
+        if (fields != NULL && cut_spec_parse(&cut, fields, delim != 0 ? delim : '\t') == -1) {
+            fprintf(stderr, "Bad field list: %s\n", fields);
+            return 1;
+        }
+        return cut_lines(path, &format, fields != NULL ? &cut : NULL, first, last);
+    }
+    if (sorting) {
+        sort.reverse = reverse;
+        sort.delim = delim;
+        sort.threads = threads > 0 ? threads : 1;
+        return sort_lines(path, &format, &sort);
+    }
+    if (tail_count >= 0 || reverse) {
+        return print_tail(path, &format, tail_count >= 0 ? (size_t)tail_count : SIZE_MAX, reverse);
     }
-    char* path = argv[1];
 
     Array table;
-    initArray(&table);
+    if (initArray(&table) == -1) {
+        return 1;
+    }
 
     int fd = open(path, O_RDONLY);
     if (fd == -1) {
@@ -109,35 +434,44 @@ int main(int argc, char* argv[]) {
     printf("Starting file analysis with memory mapping. File size: %zu bytes\n", file_size);
 
     // Analyze file using memory mapping instead of read()
-    off_t lineOffset = 0; //Offset of the line in the file
-    off_t lineLength = 0; 
-    for (size_t i = 0; i < file_size; i++) {
-        char c = mapped_file[i];
-        if (c == '\n') {
-            Line current = { lineOffset, lineLength };
-            insertArray(&table, current);
-
-            lineOffset += lineLength + 1;
-            lineLength = 0;
-        }
-        else {
-            lineLength++;
+    // With -i the index kept in path.lidx is reused and only the chunks
+    // that changed since it was written are scanned again
+    // With -W the word index in path.widx is built in the same pass
+    LineStoreStats stats;
+    size_t terms = 0;
+    int built;
+    if (build_words) {
+        built = word_index_build(path, fd, mapped_file, file_size, &table, &terms);
+    } else if (incremental) {
+        built = line_store_update(path, fd, mapped_file, file_size, &table, &stats);
+    } else {
+        built = build_record_table_mem(mapped_file, file_size, &format, &table);
+    }
+    if (built == 0 && build_words) {
+        printf("Word index: %zu distinct words written to %s.widx\n", terms, path);
+    } else if (built == 0 && incremental) {
+        if (stats.first_build) {
+            printf("Index: built, %zu bytes scanned\n", stats.rescanned_bytes);
+        } else {
+            printf("Index: %zu of %zu chunks reused%s, %zu bytes rescanned\n", stats.reused, stats.chunks,
+                   stats.unchanged ? " (file unchanged)" : "", stats.rescanned_bytes);
         }
     }
-
-    if (lineLength > 0) {
-        Line current = { lineOffset, lineLength };
-        insertArray(&table, current);
+    if (built == -1) {
+        munmap(mapped_file, file_size);
+        close(fd);
+        freeArray(&table);
+        return 1;
     }
 
     // Print debugging table as mentioned in comments
     printf("\nLine Table (for debugging):\n");
     printf(" Line | Offset | Length\n");
     printf("------|--------|-------\n");
-    for (int i = 0; i < table.cnt; i++) {
-        printf("%5d | %6ld | %6ld\n", i + 1, table.array[i].offset, table.array[i].length);
+    for (size_t i = 0; i < table.cnt; i++) {
+        printf("%5zu | %6ld | %6ld\n", i + 1, (long)table.array[i].offset, (long)table.array[i].length);
     }
-    printf("\nTotal lines: %d\n\n", table.cnt);
+    printf("\nTotal lines: %zu\n\n", table.cnt);
 
     // Set alarm for 5 seconds (only for the first prompt)
     printf("You have 5 seconds to enter a line number. If no input, entire file will be printed.\n");
@@ -192,8 +526,8 @@ int main(int argc, char* argv[]) {
         }
 
         if (num == 0) { break; }
-        if (table.cnt < num) {
-            printf("The file contains only %d line(s).\n", table.cnt);
+        if (table.cnt < (size_t)num) {
+            printf("The file contains only %zu line(s).\n", table.cnt);
             // No more alarm after the first valid input
             continue;
         }
@@ -216,6 +550,11 @@ int main(int argc, char* argv[]) {
         // No more alarm after the first valid input
     }
 
+    // The sidecar of a first -i build is written from the mapping
+    if (line_store_wait() == -1) {
+        fprintf(stderr, "Could not write %s.lidx, the next run scans the file again\n", path);
+    }
+
     // Clean up memory mapping
     if (mapped_file != NULL) {
         munmap(mapped_file, file_size);
@@ -224,4 +563,6 @@ int main(int argc, char* argv[]) {
     freeArray(&table);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// gcc -pthread task7.c ../lineindex/line_index.c ../lineindex/line_store.c ../lineindex/word_index.c ../lineindex/line_sort.c ../lineindex/line_cut.c ../lineindex/line_diff.c -o line_reader
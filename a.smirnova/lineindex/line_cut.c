@@ -0,0 +1,203 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "line_cut.h"
+
+// Leading decimal number; 0 if there are no digits
+static size_t parse_number(const char* s, const char** endp) {
+    size_t n = 0;
+
+    while (*s >= '0' && *s <= '9') {
+        n = n * 10 + (size_t)(*s - '0');
+        s++;
+    }
+    *endp = s;
+    return n;
+}
+
+// One "a-b" item, stopping at stop or the end of the string
+static int parse_range(const char* s, char stop, const char** endp, size_t* first, size_t* last) {
+    const char* p;
+
+    *first = parse_number(s, &p);
+    if (p == s) {
+        *first = 1;
+        if (*p != '-') {
+            return -1;
+        }
+    } else if (*first == 0) {
+        return -1;
+    }
+    if (*p == '-') {
+        const char* q = p + 1;
+        *last = parse_number(q, &p);
+        if (p == q) {
+            if (q == s + 1) {
+                return -1;      // a lone "-"
+            }
+            *last = SIZE_MAX;
+        }
+    } else {
+        *last = *first;
+    }
+    if ((*p != '\0' && *p != stop) || *last < *first) {
+        return -1;
+    }
+    *endp = p;
+    return 0;
+}
+
+int line_range_parse(const char* s, size_t* first, size_t* last) {
+    const char* end;
+
+    if (parse_range(s, '\0', &end, first, last) == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int cut_spec_parse(CutSpec* spec, const char* list, char delim) {
+    const char* p = list;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->delim = delim;
+    for (;;) {
+        CutRange r;
+        if (spec->count == CUT_RANGES_MAX || parse_range(p, ',', &p, &r.first, &r.last) == -1) {
+            errno = EINVAL;
+            return -1;
+        }
+        spec->ranges[spec->count++] = r;
+        if (r.last > spec->last) {
+            spec->last = r.last;
+        }
+        for (size_t f = r.first; f <= 64 && f <= r.last; f++) {
+            spec->low |= (uint64_t)1 << (f - 1);
+        }
+        if (*p == '\0') {
+            return 0;
+        }
+        p++;
+    }
+}
+
+static int selected(const CutSpec* spec, size_t field) {
+    if (field <= 64) {
+        return (spec->low >> (field - 1)) & 1;
+    }
+    for (size_t i = 0; i < spec->count; i++) {
+        if (field >= spec->ranges[i].first && field <= spec->ranges[i].last) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Delimiter positions of one line, handed out in order from a bitmask of
+// the current 16-byte block
+struct delim_scan {
+    const char* block;
+    const char* end;
+    unsigned mask;
+    char delim;
+};
+
+static unsigned block_mask(const char* p, const char* end, char delim) {
+    unsigned mask = 0;
+
+#ifdef __SSE2__
+    if (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(delim)));
+    }
+#endif
+    for (int i = 0; i < 16 && p + i < end; i++) {
+        mask |= (unsigned)(p[i] == delim) << i;
+    }
+    return mask;
+}
+
+static void scan_init(struct delim_scan* sc, const char* p, const char* end, char delim) {
+    sc->block = p;
+    sc->end = end;
+    sc->delim = delim;
+    sc->mask = block_mask(p, end, delim);
+}
+
+// The next delimiter, or end when there are no more
+static const char* scan_next(struct delim_scan* sc) {
+    while (sc->mask == 0) {
+        if (sc->end - sc->block <= 16) {
+            return sc->end;
+        }
+        sc->block += 16;
+        sc->mask = block_mask(sc->block, sc->end, sc->delim);
+    }
+    const char* d = sc->block + __builtin_ctz(sc->mask);
+    sc->mask &= sc->mask - 1;
+    return d;
+}
+
+// Adjacent selected fields are contiguous in the line, delimiter included,
+// so they go out as one span
+static void cut_line(const char* p, size_t len, const CutSpec* spec, FILE* out) {
+    const char* end = p + len;
+    const char* span = NULL;
+    const char* span_end = NULL;
+    struct delim_scan sc;
+    int written = 0;
+
+    scan_init(&sc, p, end, spec->delim);
+    const char* d = scan_next(&sc);
+    if (d == end) {
+        fwrite(p, 1, len, out);
+        putc_unlocked('\n', out);
+        return;
+    }
+    for (size_t field = 1; ; field++) {
+        if (selected(spec, field)) {
+            if (span != NULL && span_end + 1 == p) {
+                span_end = d;
+            } else {
+                if (span != NULL) {
+                    if (written) {
+                        putc_unlocked(spec->delim, out);
+                    }
+                    fwrite(span, 1, span_end - span, out);
+                    written = 1;
+                }
+                span = p;
+                span_end = d;
+            }
+        }
+        if (d == end || field >= spec->last) {
+            break;
+        }
+        p = d + 1;
+        d = scan_next(&sc);
+    }
+    if (span != NULL) {
+        if (written) {
+            putc_unlocked(spec->delim, out);
+        }
+        fwrite(span, 1, span_end - span, out);
+    }
+    putc_unlocked('\n', out);
+}
+
+int line_cut(const char* data, const Line* lines, size_t count, const CutSpec* spec, FILE* out) {
+    flockfile(out);
+    for (size_t i = 0; i < count; i++) {
+        cut_line(data + lines[i].offset, lines[i].length, spec, out);
+    }
+    funlockfile(out);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef LINE_CUT_H
+#define LINE_CUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Field projection over indexed lines, like cut -f.
+ *
+ * Delimiters are found 16 bytes at a time (SSE2 compare + movemask) and
+ * walked as a bitmask, so a line is scanned once however short its fields
+ * are, and only up to the last selected field. The selected spans are
+ * written straight from the mapping, joined by the delimiter; a line
+ * without any delimiter is written whole, as cut does.
+ */
+
+#define CUT_RANGES_MAX 32
+
+typedef struct {
+    size_t first;       // 1-based, inclusive
+    size_t last;        // SIZE_MAX for "N-"
+} CutRange;
+
+typedef struct {
+    char delim;
+    uint64_t low;       // bit f-1 set when field f <= 64 is selected
+    size_t last;        // highest selected field, SIZE_MAX if open-ended
+    size_t count;
+    CutRange ranges[CUT_RANGES_MAX];
+} CutSpec;
+
+// "3,7", "2-4", "5-" or "-2" items separated by commas; -1 (EINVAL) if
+// the list is malformed or selects field 0
+int cut_spec_parse(CutSpec* spec, const char* list, char delim);
+
+// A single "a-b", "a-", "-b" or "a" range of 1-based line numbers
+int line_range_parse(const char* s, size_t* first, size_t* last);
+
+// Write the selected fields of count lines (over data) to out, each
+// followed by '\n'; 0, or -1 if writing failed
+int line_cut(const char* data, const Line* lines, size_t count, const CutSpec* spec, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
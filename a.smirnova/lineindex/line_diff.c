@@ -0,0 +1,458 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_diff.h"
+
+#define MAX_THREADS 64
+// Below this many edit steps a middle snake is always searched to the end
+#define MIN_TOO_EXPENSIVE 4096
+
+struct diff_side {
+    const DiffFile* file;
+    const Line* lines;
+    uint64_t* hashes;
+    unsigned char* changed;
+    ptrdiff_t n;
+};
+
+struct diff_ctx {
+    struct diff_side a;
+    struct diff_side b;
+    ptrdiff_t* fd;              // furthest x reached on each forward diagonal
+    ptrdiff_t* bd;              // and backward
+    ptrdiff_t too_expensive;
+};
+
+struct change {
+    ptrdiff_t a0, a1;           // deleted lines [a0, a1) of a
+    ptrdiff_t b0, b1;           // inserted lines [b0, b1) of b
+};
+
+static uint64_t hash_line(const char* p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+    uint64_t w;
+
+    while (n >= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+        p += 8;
+        n -= 8;
+    }
+    w = 0;
+    memcpy(&w, p, n);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+struct hash_job {
+    const char* data;
+    const Line* lines;
+    uint64_t* hashes;
+    size_t n;
+};
+
+static void* hash_slice(void* arg) {
+    struct hash_job* job = arg;
+
+    for (size_t i = 0; i < job->n; i++) {
+        job->hashes[i] = hash_line(job->data + job->lines[i].offset, job->lines[i].length);
+    }
+    return NULL;
+}
+
+// Hash the lines of one file, a slice of whole lines per thread
+static void hash_lines(const struct diff_side* s, int threads) {
+    struct hash_job jobs[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    size_t n = s->n;
+    int slices = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
+
+    if ((size_t)slices > n) {
+        slices = n > 0 ? (int)n : 1;
+    }
+    for (int t = 0; t < slices; t++) {
+        size_t first = n * t / slices;
+        jobs[t].data = s->file->data;
+        jobs[t].lines = s->lines + first;
+        jobs[t].hashes = s->hashes + first;
+        jobs[t].n = n * (t + 1) / slices - first;
+    }
+    // The calling thread takes the first slice
+    int started = 1;
+    for (; started < slices; started++) {
+        if (pthread_create(&tids[started], NULL, hash_slice, &jobs[started]) != 0) {
+            break;
+        }
+    }
+    hash_slice(&jobs[0]);
+    for (int t = started; t < slices; t++) {
+        hash_slice(&jobs[t]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    // A last line without a terminator never matches one with it
+    if (n > 0 && s->file->incomplete) {
+        s->hashes[n - 1] = ~s->hashes[n - 1];
+    }
+}
+
+// Equal hashes and lengths; the bytes are compared once the script is
+// found, in collect_changes
+static int same_line(const struct diff_ctx* ctx, ptrdiff_t x, ptrdiff_t y) {
+    return ctx->a.hashes[x] == ctx->b.hashes[y] && ctx->a.lines[x].length == ctx->b.lines[y].length;
+}
+
+static int same_bytes(const struct diff_ctx* ctx, ptrdiff_t x, ptrdiff_t y) {
+    Line la = ctx->a.lines[x];
+    Line lb = ctx->b.lines[y];
+    return memcmp(ctx->a.file->data + la.offset, ctx->b.file->data + lb.offset, la.length) == 0;
+}
+
+/*
+ * Find the middle snake of a[xoff, xlim) against b[yoff, ylim), or when
+ * that takes more than too_expensive steps the furthest point either
+ * search reached, and return the split in *xmid, *ymid. Diagonals are
+ * numbered x - y.
+ */
+static void middle_snake(struct diff_ctx* ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+                         ptrdiff_t yoff, ptrdiff_t ylim, ptrdiff_t* xmid, ptrdiff_t* ymid) {
+    ptrdiff_t* fd = ctx->fd;
+    ptrdiff_t* bd = ctx->bd;
+    const ptrdiff_t dmin = xoff - ylim;
+    const ptrdiff_t dmax = xlim - yoff;
+    const ptrdiff_t fmid = xoff - yoff;
+    const ptrdiff_t bmid = xlim - ylim;
+    ptrdiff_t fmin = fmid, fmax = fmid;
+    ptrdiff_t bmin = bmid, bmax = bmid;
+    const int odd = (fmid - bmid) & 1;
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+    for (ptrdiff_t c = 1; ; c++) {
+        if (fmin > dmin) {
+            fd[--fmin - 1] = -1;
+        } else {
+            fmin++;
+        }
+        if (fmax < dmax) {
+            fd[++fmax + 1] = -1;
+        } else {
+            fmax--;
+        }
+        for (ptrdiff_t d = fmax; d >= fmin; d -= 2) {
+            ptrdiff_t lo = fd[d - 1], hi = fd[d + 1];
+            ptrdiff_t x = lo >= hi ? lo + 1 : hi;
+            ptrdiff_t y = x - d;
+            while (x < xlim && y < ylim && same_line(ctx, x, y)) {
+                x++;
+                y++;
+            }
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        if (bmin > dmin) {
+            bd[--bmin - 1] = PTRDIFF_MAX;
+        } else {
+            bmin++;
+        }
+        if (bmax < dmax) {
+            bd[++bmax + 1] = PTRDIFF_MAX;
+        } else {
+            bmax--;
+        }
+        for (ptrdiff_t d = bmax; d >= bmin; d -= 2) {
+            ptrdiff_t lo = bd[d - 1], hi = bd[d + 1];
+            ptrdiff_t x = lo < hi ? lo : hi - 1;
+            ptrdiff_t y = x - d;
+            while (xoff < x && yoff < y && same_line(ctx, x - 1, y - 1)) {
+                x--;
+                y--;
+            }
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        if (c < ctx->too_expensive) {
+            continue;
+        }
+        // Give up on a minimal script: split at whichever search got
+        // further along its diagonals
+        ptrdiff_t fxy = -1, fx = xoff;
+        for (ptrdiff_t d = fmax; d >= fmin; d -= 2) {
+            ptrdiff_t x = fd[d] < xlim ? fd[d] : xlim;
+            ptrdiff_t y = x - d;
+            if (y > ylim) {
+                x = ylim + d;
+                y = ylim;
+            }
+            if (x + y > fxy) {
+                fxy = x + y;
+                fx = x;
+            }
+        }
+        ptrdiff_t bxy = PTRDIFF_MAX, bx = xlim;
+        for (ptrdiff_t d = bmax; d >= bmin; d -= 2) {
+            ptrdiff_t x = bd[d] > xoff ? bd[d] : xoff;
+            ptrdiff_t y = x - d;
+            if (y < yoff) {
+                x = yoff + d;
+                y = yoff;
+            }
+            if (x + y < bxy) {
+                bxy = x + y;
+                bx = x;
+            }
+        }
+        if ((xlim + ylim) - bxy < fxy - (xoff + yoff)) {
+            *xmid = fx;
+            *ymid = fxy - fx;
+        } else {
+            *xmid = bx;
+            *ymid = bxy - bx;
+        }
+        return;
+    }
+}
+
+// Mark the lines of a[xoff, xlim) and b[yoff, ylim) that are not part of
+// a common subsequence
+static void compare_ranges(struct diff_ctx* ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+                           ptrdiff_t yoff, ptrdiff_t ylim) {
+    while (xoff < xlim && yoff < ylim && same_line(ctx, xoff, yoff)) {
+        xoff++;
+        yoff++;
+    }
+    while (xoff < xlim && yoff < ylim && same_line(ctx, xlim - 1, ylim - 1)) {
+        xlim--;
+        ylim--;
+    }
+    if (xoff == xlim) {
+        memset(ctx->b.changed + yoff, 1, ylim - yoff);
+    } else if (yoff == ylim) {
+        memset(ctx->a.changed + xoff, 1, xlim - xoff);
+    } else {
+        ptrdiff_t xmid, ymid;
+        middle_snake(ctx, xoff, xlim, yoff, ylim, &xmid, &ymid);
+        compare_ranges(ctx, xoff, xmid, yoff, ymid);
+        compare_ranges(ctx, xmid, xlim, ymid, ylim);
+    }
+}
+
+static void print_line(const struct diff_side* s, ptrdiff_t i, const char* prefix, FILE* out) {
+    fputs(prefix, out);
+    fwrite(s->file->data + s->lines[i].offset, 1, s->lines[i].length, out);
+    putc('\n', out);
+    if (i == s->n - 1 && s->file->incomplete) {
+        fputs("\\ No newline at end of file\n", out);
+    }
+}
+
+// "first,last" of 1-based lines, or just the line when there is one
+static void print_range(ptrdiff_t first, ptrdiff_t last, FILE* out) {
+    if (first < last) {
+        fprintf(out, "%td,%td", first, last);
+    } else {
+        fprintf(out, "%td", last);
+    }
+}
+
+static void print_normal(const struct diff_ctx* ctx, const struct change* ch, size_t count, FILE* out) {
+    for (size_t k = 0; k < count; k++) {
+        const struct change* c = &ch[k];
+        char op = c->a0 == c->a1 ? 'a' : c->b0 == c->b1 ? 'd' : 'c';
+
+        print_range(c->a0 + 1, c->a1, out);
+        putc(op, out);
+        print_range(c->b0 + 1, c->b1, out);
+        putc('\n', out);
+        for (ptrdiff_t i = c->a0; i < c->a1; i++) {
+            print_line(&ctx->a, i, "< ", out);
+        }
+        if (op == 'c') {
+            fputs("---\n", out);
+        }
+        for (ptrdiff_t j = c->b0; j < c->b1; j++) {
+            print_line(&ctx->b, j, "> ", out);
+        }
+    }
+}
+
+// Unified hunk bounds: "start,count", the start being the line before
+// an empty range and the count left out when it is 1
+static void print_hunk_range(ptrdiff_t first, ptrdiff_t last, FILE* out) {
+    if (last - first == 1) {
+        fprintf(out, "%td", first + 1);
+    } else {
+        fprintf(out, "%td,%td", last > first ? first + 1 : first, last - first);
+    }
+}
+
+static void print_unified(const struct diff_ctx* ctx, const struct change* ch, size_t count,
+                          int context, FILE* out) {
+    fprintf(out, "--- %s\n+++ %s\n", ctx->a.file->label, ctx->b.file->label);
+    for (size_t k = 0; k < count; ) {
+        // Changes closer than two contexts share a hunk
+        size_t last = k;
+        while (last + 1 < count && ch[last + 1].a0 - ch[last].a1 <= 2 * context) {
+            last++;
+        }
+        ptrdiff_t a0 = ch[k].a0 > context ? ch[k].a0 - context : 0;
+        ptrdiff_t b0 = ch[k].b0 - (ch[k].a0 - a0);
+        ptrdiff_t a1 = ch[last].a1 + context < ctx->a.n ? ch[last].a1 + context : ctx->a.n;
+        ptrdiff_t b1 = ch[last].b1 + (a1 - ch[last].a1);
+
+        fputs("@@ -", out);
+        print_hunk_range(a0, a1, out);
+        fputs(" +", out);
+        print_hunk_range(b0, b1, out);
+        fputs(" @@\n", out);
+        ptrdiff_t i = a0;
+        for (size_t m = k; m <= last; m++) {
+            for (; i < ch[m].a0; i++) {
+                print_line(&ctx->a, i, " ", out);
+            }
+            for (; i < ch[m].a1; i++) {
+                print_line(&ctx->a, i, "-", out);
+            }
+            for (ptrdiff_t j = ch[m].b0; j < ch[m].b1; j++) {
+                print_line(&ctx->b, j, "+", out);
+            }
+        }
+        for (; i < a1; i++) {
+            print_line(&ctx->a, i, " ", out);
+        }
+        k = last + 1;
+    }
+}
+
+// Group the changed flags into changes. Unchanged lines pair up in order
+// and are checked byte for byte; a pair that only shares a hash becomes a
+// change of its own
+static struct change* collect_changes(struct diff_ctx* ctx, size_t* count) {
+    struct change* ch = NULL;
+    size_t cnt = 0, cap = 0;
+    ptrdiff_t i = 0, j = 0;
+
+    while (i < ctx->a.n || j < ctx->b.n) {
+        if (i < ctx->a.n && j < ctx->b.n && !ctx->a.changed[i] && !ctx->b.changed[j]) {
+            if (same_bytes(ctx, i, j)) {
+                i++;
+                j++;
+                continue;
+            }
+            ctx->a.changed[i] = ctx->b.changed[j] = 1;
+        }
+        struct change c = { i, i, j, j };
+        while (i < ctx->a.n && ctx->a.changed[i]) {
+            i++;
+        }
+        while (j < ctx->b.n && ctx->b.changed[j]) {
+            j++;
+        }
+        c.a1 = i;
+        c.b1 = j;
+        if (cnt == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct change* grown = realloc(ch, cap * sizeof(*ch));
+            if (grown == NULL) {
+                perror("realloc");
+                free(ch);
+                return NULL;
+            }
+            ch = grown;
+        }
+        ch[cnt++] = c;
+    }
+    *count = cnt;
+    return ch != NULL ? ch : malloc(1);
+}
+
+int line_diff(const DiffFile* a, const DiffFile* b, const DiffOptions* opt, FILE* out) {
+    struct diff_ctx ctx;
+    ptrdiff_t* diagonals = NULL;
+    struct change* changes = NULL;
+    size_t count = 0;
+    int rc = -1;
+
+    ctx.a.file = a;
+    ctx.a.lines = a->lines->array;
+    ctx.a.n = a->lines->cnt;
+    ctx.b.file = b;
+    ctx.b.lines = b->lines->array;
+    ctx.b.n = b->lines->cnt;
+    ctx.a.hashes = malloc(ctx.a.n * sizeof(uint64_t) + 1);
+    ctx.b.hashes = malloc(ctx.b.n * sizeof(uint64_t) + 1);
+    ctx.a.changed = calloc(ctx.a.n + 1, 1);
+    ctx.b.changed = calloc(ctx.b.n + 1, 1);
+    if (ctx.a.hashes == NULL || ctx.b.hashes == NULL || ctx.a.changed == NULL || ctx.b.changed == NULL) {
+        perror("malloc");
+        goto done;
+    }
+    hash_lines(&ctx.a, opt->threads);
+    hash_lines(&ctx.b, opt->threads);
+
+    // Only the part between the common head and tail needs diagonals
+    ptrdiff_t xoff = 0, yoff = 0, xlim = ctx.a.n, ylim = ctx.b.n;
+    while (xoff < xlim && yoff < ylim && same_line(&ctx, xoff, yoff)) {
+        xoff++;
+        yoff++;
+    }
+    while (xoff < xlim && yoff < ylim && same_line(&ctx, xlim - 1, ylim - 1)) {
+        xlim--;
+        ylim--;
+    }
+    ptrdiff_t span = (xlim - xoff) + (ylim - yoff) + 3;
+    diagonals = malloc(2 * span * sizeof(ptrdiff_t));
+    if (diagonals == NULL) {
+        perror("malloc");
+        goto done;
+    }
+    // Diagonal x - y runs from xoff - ylim to xlim - yoff, and xoff == yoff
+    ctx.fd = diagonals + (ylim - yoff) + 1;
+    ctx.bd = ctx.fd + span;
+    ctx.too_expensive = 1;
+    for (ptrdiff_t d = span; d != 0; d >>= 2) {
+        ctx.too_expensive <<= 1;
+    }
+    if (ctx.too_expensive < MIN_TOO_EXPENSIVE) {
+        ctx.too_expensive = MIN_TOO_EXPENSIVE;
+    }
+    compare_ranges(&ctx, xoff, xlim, yoff, ylim);
+
+    changes = collect_changes(&ctx, &count);
+    if (changes == NULL) {
+        goto done;
+    }
+    if (count > 0) {
+        if (opt->unified) {
+            print_unified(&ctx, changes, count, opt->context, out);
+        } else {
+            print_normal(&ctx, changes, count, out);
+        }
+    }
+    rc = ferror(out) ? -1 : count > 0;
+
+done:
+    free(changes);
+    free(diagonals);
+    free(ctx.a.hashes);
+    free(ctx.b.hashes);
+    free(ctx.a.changed);
+    free(ctx.b.changed);
+    return rc;
+}
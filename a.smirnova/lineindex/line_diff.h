@@ -0,0 +1,49 @@
+#ifndef LINE_DIFF_H
+#define LINE_DIFF_H
+
+#include <stdio.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Line diff of two indexed files.
+ *
+ * Every line of both files is hashed first, on several threads that each
+ * take a slice of the line table. The edit script is then found with
+ * Myers' linear-space algorithm (middle snake, divide and conquer) over
+ * the hashes and lengths. Every line the script keeps as common is then
+ * compared byte for byte in the mappings, and a pair that only shares a
+ * hash is reported as changed, so a collision cannot hide a change.
+ * Like diff(1), the search settles for a non-minimal split once a middle
+ * snake gets too expensive, so the time stays near O((N+M) D) and the
+ * memory is a few words per line.
+ */
+
+typedef struct {
+    const char* data;
+    const Array* lines;
+    int incomplete;     // the last line has no terminator
+    const char* label;  // file name (and date) for the unified header
+} DiffFile;
+
+typedef struct {
+    int unified;
+    int context;        // lines of context around unified hunks
+    int threads;
+} DiffOptions;
+
+#define DIFF_OPTIONS_DEFAULT { 0, 3, 1 }
+
+// Write the differences from a to b to out, in normal or unified format;
+// 0 if the files have the same lines, 1 if they differ, -1 on failure
+int line_diff(const DiffFile* a, const DiffFile* b, const DiffOptions* opt, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
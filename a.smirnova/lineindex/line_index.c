@@ -0,0 +1,564 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "line_index.h"
+
+#define READ_BLOCK (1 << 16)
+
+int initArray(Array* a) {
+    a->array = malloc(sizeof(Line));
+    a->cnt = 0;
+    a->cap = a->array != NULL ? 1 : 0;
+    return a->array != NULL ? 0 : -1;
+}
+
+int insertArray(Array* a, Line element) {
+    if (a->cnt == a->cap) {
+        size_t cap = a->cap ? a->cap * 2 : 16;
+        Line* array = realloc(a->array, cap * sizeof(Line));
+        if (array == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        a->array = array;
+        a->cap = cap;
+    }
+
+    a->array[a->cnt++] = element;
+    return 0;
+}
+
+void freeArray(Array* a) {
+    free(a->array);
+    a->array = NULL;
+    a->cnt = a->cap = 0;
+}
+
+typedef struct {
+    const RecordFormat* fmt;
+    Array* table;
+    off_t line_start;
+    uint64_t in_quote;      // all ones inside a quoted CSV field
+} RecordScan;
+
+static const RecordFormat newline_format = RECORD_FORMAT_NEWLINE;
+
+// Close the record that ends at file offset end; at is that byte in the
+// current buffer, so at[-1] is always readable when the record is not empty
+static int emit_record(RecordScan* s, off_t end, const char* at, size_t delim_len) {
+    Line current = { s->line_start, end - s->line_start };
+
+    if ((s->fmt->kind == RECORD_CRLF || s->fmt->kind == RECORD_CSV) &&
+        current.length > 0 && at[-1] == '\r') {
+        current.length--;
+    }
+    if (insertArray(s->table, current) == -1) {
+        return -1;
+    }
+    s->line_start = end + delim_len;
+    return 0;
+}
+
+static int scan_byte(RecordScan* s, const char* buf, size_t len, size_t from, off_t base, char delim) {
+    const char* p = buf + from;
+    const char* end = buf + len;
+    const char* hit;
+
+    while (p < end && (hit = memchr(p, delim, end - p)) != NULL) {
+        if (emit_record(s, base + (hit - buf), hit, 1) == -1) {
+            return -1;
+        }
+        p = hit + 1;
+    }
+    return 0;
+}
+
+static int scan_separator(RecordScan* s, const char* buf, size_t len, off_t base) {
+    const char* sep = s->fmt->sep;
+    size_t sep_len = s->fmt->sep_len;
+    // Never match inside the separator that closed the previous record
+    size_t from = s->line_start > base ? (size_t)(s->line_start - base) : 0;
+    const char* hit;
+
+    while (from < len && (hit = memmem(buf + from, len - from, sep, sep_len)) != NULL) {
+        if (emit_record(s, base + (hit - buf), hit, sep_len) == -1) {
+            return -1;
+        }
+        from = hit - buf + sep_len;
+    }
+    return 0;
+}
+
+/*
+ * CSV: a '\n' ends a record unless an odd number of '"' precede it in the
+ * record ("" inside a field toggles twice, so it needs no special case).
+ * With SSE2 the quotes and newlines of 64 bytes become two bitmasks; the
+ * prefix XOR of the quote mask marks every byte inside quotes, and the
+ * newlines left outside are walked with ctz.
+ */
+static int scan_csv(RecordScan* s, const char* buf, size_t len, size_t from, off_t base) {
+    size_t i = from;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t quotes = 0, newlines = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(buf + i + 16 * k));
+            quotes |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (16 * k);
+            newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * k);
+        }
+        uint64_t inside = quotes;
+        inside ^= inside << 1;
+        inside ^= inside << 2;
+        inside ^= inside << 4;
+        inside ^= inside << 8;
+        inside ^= inside << 16;
+        inside ^= inside << 32;
+        inside ^= s->in_quote;
+        s->in_quote = (uint64_t)((int64_t)inside >> 63);
+
+        newlines &= ~inside;
+        while (newlines != 0) {
+            size_t j = i + __builtin_ctzll(newlines);
+            if (emit_record(s, base + j, buf + j, 1) == -1) {
+                return -1;
+            }
+            newlines &= newlines - 1;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (buf[i] == '"') {
+            s->in_quote = ~s->in_quote;
+        } else if (buf[i] == '\n' && !s->in_quote) {
+            if (emit_record(s, base + i, buf + i, 1) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Scan buf, which starts at file offset base; bytes before from were
+// already scanned and are only there as context for the next block
+static int scan_block(RecordScan* s, const char* buf, size_t len, size_t from, off_t base) {
+    const RecordFormat* fmt = s->fmt;
+
+    switch (fmt->kind) {
+    case RECORD_NEWLINE:
+    case RECORD_CRLF:
+        return scan_byte(s, buf, len, from, base, '\n');
+    case RECORD_NUL:
+        return scan_byte(s, buf, len, from, base, '\0');
+    case RECORD_SEPARATOR:
+        if (fmt->sep_len == 1) {
+            return scan_byte(s, buf, len, from, base, fmt->sep[0]);
+        }
+        return scan_separator(s, buf, len, base);
+    case RECORD_CSV:
+        return scan_csv(s, buf, len, from, base);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+// Bytes of the previous block the scanner must still see
+static size_t block_context(const RecordFormat* fmt) {
+    switch (fmt->kind) {
+    case RECORD_CRLF:
+    case RECORD_CSV:
+        return 1;
+    case RECORD_SEPARATOR:
+        return fmt->sep_len - 1;
+    default:
+        return 0;
+    }
+}
+
+static int finish_table(RecordScan* s, off_t size) {
+    if (size > s->line_start) {
+        Line current = { s->line_start, size - s->line_start };
+        return insertArray(s->table, current);
+    }
+    return 0;
+}
+
+// Fixed-width records need no scan at all
+static int build_fixed_table(off_t size, size_t width, Array* table) {
+    for (off_t offset = 0; offset < size; offset += width) {
+        Line current = { offset, size - offset < (off_t)width ? size - offset : (off_t)width };
+        if (insertArray(table, current) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int record_format_parse(RecordFormat* fmt, const char* spec) {
+    static const RecordFormat plain = RECORD_FORMAT_NEWLINE;
+
+    *fmt = plain;
+    if (strcmp(spec, "lf") == 0) {
+        return 0;
+    }
+    if (strcmp(spec, "crlf") == 0) {
+        fmt->kind = RECORD_CRLF;
+        return 0;
+    }
+    if (strcmp(spec, "nul") == 0) {
+        fmt->kind = RECORD_NUL;
+        fmt->sep[0] = '\0';
+        return 0;
+    }
+    if (strcmp(spec, "csv") == 0) {
+        fmt->kind = RECORD_CSV;
+        return 0;
+    }
+    if (strncmp(spec, "fixed:", 6) == 0) {
+        char* end;
+        unsigned long width = strtoul(spec + 6, &end, 10);
+        if (*end != '\0' || width == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        fmt->kind = RECORD_FIXED;
+        fmt->width = width;
+        return 0;
+    }
+    if (strncmp(spec, "sep:", 4) == 0) {
+        size_t n = 0;
+        for (const char* p = spec + 4; *p != '\0'; p++) {
+            char c = *p;
+            if (c == '\\' && p[1] != '\0') {
+                switch (*++p) {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case '0': c = '\0'; break;
+                default: c = *p; break;
+                }
+            }
+            if (n == RECORD_SEP_MAX) {
+                errno = EINVAL;
+                return -1;
+            }
+            fmt->sep[n++] = c;
+        }
+        if (n == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        fmt->kind = RECORD_SEPARATOR;
+        fmt->sep_len = n;
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int build_record_table_fd(int fd, const RecordFormat* fmt, Array* table) {
+    RecordScan s = { fmt, table, 0, 0 };
+    size_t context = block_context(fmt), keep = 0;
+    off_t base = 0;
+    ssize_t n;
+
+    if (fmt->kind == RECORD_FIXED) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("fstat");
+            return -1;
+        }
+        return build_fixed_table(st.st_size, fmt->width, table);
+    }
+
+    char* buf = malloc(READ_BLOCK + RECORD_SEP_MAX);
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    if (lseek(fd, 0L, SEEK_SET) == -1) {
+        perror("lseek");
+        free(buf);
+        return -1;
+    }
+    while ((n = read(fd, buf + keep, READ_BLOCK)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            free(buf);
+            return -1;
+        }
+        // buf[0] sits at file offset base - keep
+        if (scan_block(&s, buf, keep + n, keep, base - keep) == -1) {
+            free(buf);
+            return -1;
+        }
+        base += n;
+        size_t next = keep + n < context ? keep + n : context;
+        memmove(buf, buf + keep + n - next, next);
+        keep = next;
+    }
+    free(buf);
+    return finish_table(&s, base);
+}
+
+int build_record_table_mem(const char* data, size_t size, const RecordFormat* fmt, Array* table) {
+    RecordScan s = { fmt, table, 0, 0 };
+
+    if (fmt->kind == RECORD_FIXED) {
+        return build_fixed_table(size, fmt->width, table);
+    }
+    if (size > 0 && scan_block(&s, data, size, 0, 0) == -1) {
+        return -1;
+    }
+    return finish_table(&s, size);
+}
+
+int build_line_table_fd(int fd, Array* table) {
+    return build_record_table_fd(fd, &newline_format, table);
+}
+
+int build_line_table_mem(const char* data, size_t size, Array* table) {
+    return build_record_table_mem(data, size, &newline_format, table);
+}
+
+// Load the aligned block that ends at or just before end
+static int reverse_load(LineReverse* r, off_t end) {
+    off_t start = (end - 1) & ~(off_t)(READ_BLOCK - 1);
+    size_t got = 0;
+
+    while (got < (size_t)(end - start)) {
+        ssize_t n = pread(r->fd, r->block + got, end - start - got, start + got);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pread");
+            return -1;
+        }
+        if (n == 0) {
+            // The file shrank under us
+            errno = EIO;
+            perror("pread");
+            return -1;
+        }
+        got += n;
+    }
+    r->data = r->block;
+    r->block_off = start;
+    return 0;
+}
+
+int line_reverse_mem(LineReverse* r, const char* data, size_t size) {
+    r->fd = -1;
+    r->data = data;
+    r->block = NULL;
+    r->block_off = 0;
+    r->end = size;
+    // A trailing newline ends the last line, it does not start an empty one
+    if (size > 0 && data[size - 1] == '\n') {
+        r->end--;
+    }
+    r->scan = r->end;
+    r->done = size == 0;
+    return 0;
+}
+
+int line_reverse_fd(LineReverse* r, int fd) {
+    struct stat st;
+
+    r->fd = fd;
+    r->data = r->block = NULL;
+    r->block_off = r->end = r->scan = 0;
+    r->done = 1;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    r->block = malloc(READ_BLOCK);
+    if (r->block == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    if (reverse_load(r, st.st_size) == -1) {
+        line_reverse_close(r);
+        return -1;
+    }
+    r->end = st.st_size;
+    if (r->data[r->end - 1 - r->block_off] == '\n') {
+        r->end--;
+    }
+    r->scan = r->end;
+    r->done = 0;
+    return 0;
+}
+
+int line_reverse_next(LineReverse* r, Line* out) {
+    if (r->done) {
+        return 0;
+    }
+    while (1) {
+        if (r->scan > r->block_off) {
+            const char* nl = memrchr(r->data, '\n', r->scan - r->block_off);
+            if (nl != NULL) {
+                off_t pos = r->block_off + (nl - r->data);
+                out->offset = pos + 1;
+                out->length = r->end - (pos + 1);
+                r->end = r->scan = pos;
+                return 1;
+            }
+            r->scan = r->block_off;
+        }
+        if (r->block_off == 0) {
+            out->offset = 0;
+            out->length = r->end;
+            r->done = 1;
+            return 1;
+        }
+        // The line starts in an earlier block
+        if (reverse_load(r, r->block_off) == -1) {
+            return -1;
+        }
+    }
+}
+
+void line_reverse_close(LineReverse* r) {
+    free(r->block);
+    r->block = NULL;
+    r->data = NULL;
+    r->done = 1;
+}
+
+static int collect_suffix(LineReverse* r, size_t n, Array* table) {
+    size_t first = table->cnt;
+    Line line;
+    int rc = 0;
+
+    while (table->cnt - first < n && (rc = line_reverse_next(r, &line)) == 1) {
+        if (insertArray(table, line) == -1) {
+            return -1;
+        }
+    }
+    if (rc == -1) {
+        return -1;
+    }
+    // Found last first, stored in file order
+    for (size_t i = first, j = table->cnt; i + 1 < j; i++, j--) {
+        Line t = table->array[i];
+        table->array[i] = table->array[j - 1];
+        table->array[j - 1] = t;
+    }
+    return 0;
+}
+
+int build_line_suffix_mem(const char* data, size_t size, size_t n, Array* table) {
+    LineReverse r;
+
+    line_reverse_mem(&r, data, size);
+    return collect_suffix(&r, n, table);
+}
+
+int build_line_suffix_fd(int fd, size_t n, Array* table) {
+    LineReverse r;
+    int rc;
+
+    if (line_reverse_fd(&r, fd) == -1) {
+        return -1;
+    }
+    rc = collect_suffix(&r, n, table);
+    line_reverse_close(&r);
+    return rc;
+}
+
+int line_index_map(LineIndex* idx, const char* path) {
+    struct stat st;
+
+    idx->data = NULL;
+    idx->size = 0;
+    idx->lines.array = NULL;
+    idx->lines.cnt = idx->lines.cap = 0;
+
+    idx->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (idx->fd == -1) {
+        return -1;
+    }
+    if (fstat(idx->fd, &st) == -1) {
+        goto fail;
+    }
+    idx->size = st.st_size;
+    // mmap of an empty file fails, an empty file simply has no lines
+    if (idx->size > 0) {
+        void* map = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, idx->fd, 0);
+        if (map == MAP_FAILED) {
+            goto fail;
+        }
+        idx->data = map;
+    }
+    if (initArray(&idx->lines) == -1) {
+        goto fail;
+    }
+    return 0;
+
+fail:;
+    int saved = errno;
+    line_index_close(idx);
+    errno = saved;
+    return -1;
+}
+
+int line_index_open(LineIndex* idx, const char* path) {
+    return line_index_open_format(idx, path, &newline_format);
+}
+
+int line_index_open_format(LineIndex* idx, const char* path, const RecordFormat* fmt) {
+    if (line_index_map(idx, path) == -1) {
+        return -1;
+    }
+    if (idx->size > 0) {
+        madvise((void*)idx->data, idx->size, MADV_SEQUENTIAL);
+    }
+    if (build_record_table_mem(idx->data, idx->size, fmt, &idx->lines) == -1) {
+        int saved = errno;
+        line_index_close(idx);
+        errno = saved;
+        return -1;
+    }
+    if (idx->size > 0) {
+        madvise((void*)idx->data, idx->size, MADV_NORMAL);
+    }
+    return 0;
+}
+
+void line_index_close(LineIndex* idx) {
+    if (idx->data != NULL) {
+        munmap((void*)idx->data, idx->size);
+        idx->data = NULL;
+    }
+    if (idx->fd != -1) {
+        close(idx->fd);
+        idx->fd = -1;
+    }
+    freeArray(&idx->lines);
+    idx->size = 0;
+}
@@ -0,0 +1,131 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Line index shared by the line readers (tasks 5-7).
+ *
+ * The table holds the offset and length of every line, without the '\n'.
+ * A last line without a trailing newline is indexed as well, so "a\nb"
+ * and "a\nb\n" both have two lines.
+ *
+ * Records other than '\n'-terminated lines are described by a RecordFormat;
+ * the line functions below are the RECORD_NEWLINE case of the record ones.
+ */
+
+typedef struct {
+    off_t offset;
+    off_t length;
+} Line;
+
+typedef struct {
+    Line* array;
+    size_t cnt;
+    size_t cap;
+} Array;
+
+int initArray(Array* a);
+int insertArray(Array* a, Line element);
+void freeArray(Array* a);
+
+#define RECORD_SEP_MAX 16
+
+typedef enum {
+    RECORD_NEWLINE,     // '\n', the default
+    RECORD_CRLF,        // '\n', a '\r' before it is not part of the record
+    RECORD_NUL,         // '\0', as written by find -print0
+    RECORD_SEPARATOR,   // any string of up to RECORD_SEP_MAX bytes
+    RECORD_FIXED,       // every width bytes, the last record may be short
+    RECORD_CSV          // '\n' outside double quotes, CRLF allowed
+} RecordKind;
+
+typedef struct {
+    RecordKind kind;
+    size_t width;
+    size_t sep_len;
+    char sep[RECORD_SEP_MAX];
+} RecordFormat;
+
+#define RECORD_FORMAT_NEWLINE { RECORD_NEWLINE, 0, 1, "\n" }
+
+// "lf", "crlf", "nul", "csv", "fixed:N" or "sep:STR" (\n \r \t \0 escapes)
+int record_format_parse(RecordFormat* fmt, const char* spec);
+
+int build_record_table_fd(int fd, const RecordFormat* fmt, Array* table);
+int build_record_table_mem(const char* data, size_t size, const RecordFormat* fmt, Array* table);
+
+// Index a file through read() in large blocks, from offset 0
+int build_line_table_fd(int fd, Array* table);
+// Index a buffer already in memory, e.g. a mapped file
+int build_line_table_mem(const char* data, size_t size, Array* table);
+
+/*
+ * Backward scan from the end of the file ('\n' lines only). Lines come
+ * out last first, with the offsets and lengths the forward index would
+ * give them. Only the blocks holding the lines asked for are searched
+ * (memrchr over a buffer, or aligned pread blocks over a descriptor), so
+ * the cost does not depend on the size of the file.
+ */
+typedef struct {
+    int fd;               // -1 when scanning a buffer
+    const char* data;     // the buffer, or the block loaded from fd
+    char* block;
+    off_t block_off;      // file offset of data[0]
+    off_t end;            // end of the next line, exclusive
+    off_t scan;           // [block_off, scan) is still to be searched
+    int done;
+} LineReverse;
+
+int line_reverse_mem(LineReverse* r, const char* data, size_t size);
+int line_reverse_fd(LineReverse* r, int fd);
+// 1 with *out set, 0 past the first line, -1 on a read error
+int line_reverse_next(LineReverse* r, Line* out);
+void line_reverse_close(LineReverse* r);
+
+// Append the last n lines in file order, without indexing the rest
+int build_line_suffix_mem(const char* data, size_t size, size_t n, Array* table);
+int build_line_suffix_fd(int fd, size_t n, Array* table);
+
+/*
+ * A file mapped read-only together with its index. Lines handed out by
+ * line_index_get point straight into the mapping and stay valid until
+ * line_index_close.
+ */
+typedef struct {
+    int fd;
+    const char* data;
+    size_t size;
+    Array lines;
+} LineIndex;
+
+int line_index_open(LineIndex* idx, const char* path);
+int line_index_open_format(LineIndex* idx, const char* path, const RecordFormat* fmt);
+// Map the file but leave the index empty, for callers that only need the
+// end of it (line_reverse_mem / build_line_suffix_mem over idx->data)
+int line_index_map(LineIndex* idx, const char* path);
+void line_index_close(LineIndex* idx);
+
+static inline size_t line_index_count(const LineIndex* idx) {
+    return idx->lines.cnt;
+}
+
+// Zero-based line n, or NULL if out of range
+static inline const char* line_index_get(const LineIndex* idx, size_t n, size_t* len) {
+    if (n >= idx->lines.cnt) {
+        return NULL;
+    }
+    *len = (size_t)idx->lines.array[n].length;
+    return idx->data + idx->lines.array[n].offset;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef LINE_INDEX_HPP
+#define LINE_INDEX_HPP
+
+// Header-only C++ wrapper over line_index.h. Lines are std::string_view /
+// std::span over the mapping, nothing is copied.
+
+#include <cerrno>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "line_index.h"
+
+namespace lineindex {
+
+// Tag for File: map the file but do not index it
+struct map_only_t {
+    explicit map_only_t() = default;
+};
+inline constexpr map_only_t map_only{};
+
+// Lines of a buffer from last to first, found by scanning backwards
+class ReverseLines {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::string_view;
+
+        iterator() = default;
+        explicit iterator(std::string_view text) : base_(text.data()), live_(true) {
+            line_reverse_mem(&scan_, text.data(), text.size());
+            ++*this;
+        }
+
+        std::string_view operator*() const {
+            return std::string_view(base_ + cur_.offset, static_cast<std::size_t>(cur_.length));
+        }
+
+        iterator& operator++() {
+            live_ = line_reverse_next(&scan_, &cur_) == 1;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        // Byte offset of the current line in the buffer
+        off_t offset() const { return cur_.offset; }
+
+        friend bool operator==(const iterator& a, const iterator& b) {
+            return a.live_ == b.live_ && (!a.live_ || a.cur_.offset == b.cur_.offset);
+        }
+        friend bool operator!=(const iterator& a, const iterator& b) { return !(a == b); }
+
+    private:
+        const char* base_ = nullptr;
+        LineReverse scan_{};
+        Line cur_{};
+        bool live_ = false;
+    };
+
+    explicit ReverseLines(std::string_view text) : text_(text) {}
+
+    iterator begin() const { return iterator(text_); }
+    iterator end() const { return iterator(); }
+
+private:
+    std::string_view text_;
+};
+
+class File {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::string_view;
+
+        iterator() = default;
+        iterator(const File* file, std::size_t n) : file_(file), n_(n) {}
+
+        std::string_view operator*() const { return (*file_)[n_]; }
+        std::string_view operator[](difference_type d) const { return (*file_)[n_ + d]; }
+
+        iterator& operator++() { ++n_; return *this; }
+        iterator operator++(int) { iterator t = *this; ++n_; return t; }
+        iterator& operator--() { --n_; return *this; }
+        iterator operator--(int) { iterator t = *this; --n_; return t; }
+        iterator& operator+=(difference_type d) { n_ += d; return *this; }
+        iterator& operator-=(difference_type d) { n_ -= d; return *this; }
+        friend iterator operator+(iterator it, difference_type d) { return it += d; }
+        friend iterator operator+(difference_type d, iterator it) { return it += d; }
+        friend iterator operator-(iterator it, difference_type d) { return it -= d; }
+        friend difference_type operator-(const iterator& a, const iterator& b) {
+            return static_cast<difference_type>(a.n_) - static_cast<difference_type>(b.n_);
+        }
+
+        friend bool operator==(const iterator& a, const iterator& b) { return a.n_ == b.n_; }
+        friend bool operator!=(const iterator& a, const iterator& b) { return a.n_ != b.n_; }
+        friend bool operator<(const iterator& a, const iterator& b) { return a.n_ < b.n_; }
+        friend bool operator>(const iterator& a, const iterator& b) { return a.n_ > b.n_; }
+        friend bool operator<=(const iterator& a, const iterator& b) { return a.n_ <= b.n_; }
+        friend bool operator>=(const iterator& a, const iterator& b) { return a.n_ >= b.n_; }
+
+        // Zero-based line number the iterator points at
+        std::size_t line() const { return n_; }
+
+    private:
+        const File* file_ = nullptr;
+        std::size_t n_ = 0;
+    };
+
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+
+    explicit File(const std::string& path) {
+        if (line_index_open(&idx_, path.c_str()) == -1) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        open_ = true;
+    }
+
+    // Records in another format, e.g. from record_format_parse
+    File(const std::string& path, const RecordFormat& format) {
+        if (line_index_open_format(&idx_, path.c_str(), &format) == -1) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        open_ = true;
+    }
+
+    // Mapped only: size() is 0 and only contents(), reverse() and tail() apply
+    File(const std::string& path, map_only_t) {
+        if (line_index_map(&idx_, path.c_str()) == -1) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        open_ = true;
+    }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    File(File&& other) noexcept : idx_(other.idx_), open_(other.open_) {
+        other.open_ = false;
+    }
+
+    File& operator=(File&& other) noexcept {
+        if (this != &other) {
+            close();
+            idx_ = other.idx_;
+            open_ = std::exchange(other.open_, false);
+        }
+        return *this;
+    }
+
+    ~File() { close(); }
+
+    std::size_t size() const { return line_index_count(&idx_); }
+    bool empty() const { return size() == 0; }
+
+    // Zero-based, unchecked like std::vector::operator[]
+    std::string_view operator[](std::size_t n) const {
+        const Line& l = idx_.lines.array[n];
+        return std::string_view(idx_.data + l.offset, static_cast<std::size_t>(l.length));
+    }
+
+    std::string_view at(std::size_t n) const {
+        if (n >= size()) {
+            throw std::out_of_range("lineindex::File::at");
+        }
+        return (*this)[n];
+    }
+
+#if __cplusplus >= 202002L
+    std::span<const char> bytes(std::size_t n) const {
+        std::string_view v = (*this)[n];
+        return std::span<const char>(v.data(), v.size());
+    }
+
+    std::span<const Line> entries() const {
+        return std::span<const Line>(idx_.lines.array, idx_.lines.cnt);
+    }
+#endif
+
+    // The whole mapping
+    std::string_view contents() const {
+        return std::string_view(idx_.data ? idx_.data : "", idx_.size);
+    }
+
+    // All lines last first; touches only as much of the file as is consumed
+    ReverseLines reverse() const { return ReverseLines(contents()); }
+
+    // The last n lines in file order, found from the end of the mapping
+    std::vector<std::string_view> tail(std::size_t n) const {
+        std::vector<std::string_view> out;
+        for (std::string_view line : reverse()) {
+            if (out.size() == n) {
+                break;
+            }
+            out.push_back(line);
+        }
+        return std::vector<std::string_view>(out.rbegin(), out.rend());
+    }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, size()); }
+    reverse_iterator rbegin() const { return reverse_iterator(end()); }
+    reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+    // Escape hatch for the C API
+    const LineIndex* native() const { return &idx_; }
+
+private:
+    void close() {
+        if (open_) {
+            line_index_close(&idx_);
+            open_ = false;
+        }
+    }
+
+    LineIndex idx_{};
+    bool open_ = false;
+};
+
+} // namespace lineindex
+
+#endif
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "line_query.h"
+
+// Requests taken per grab, enough to keep the shared counter cold
+#define POOL_CHUNK 32
+
+void line_query_init(LineQuery* q, int fd, const char* data, const Array* table) {
+    q->fd = fd;
+    q->data = data;
+    q->lines = table->array;
+    q->cnt = table->cnt;
+}
+
+ssize_t line_pread(int fd, char* buf, size_t len, off_t offset) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, offset + got);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+ssize_t line_query_read(const LineQuery* q, size_t n, char* buf, size_t cap) {
+    if (n >= q->cnt) {
+        errno = ERANGE;
+        return -1;
+    }
+    if (cap == 0) {
+        return q->lines[n].length;
+    }
+
+    Line line = q->lines[n];
+    size_t want = (size_t)line.length < cap - 1 ? (size_t)line.length : cap - 1;
+    ssize_t got;
+
+    if (q->data != NULL) {
+        memcpy(buf, q->data + line.offset, want);
+        got = want;
+    } else {
+        got = line_pread(q->fd, buf, want, line.offset);
+        if (got == -1) {
+            return -1;
+        }
+    }
+    buf[got] = '\0';
+    // A short read means the file was truncated under the index
+    if ((size_t)got != want) {
+        errno = EIO;
+        return -1;
+    }
+    return line.length;
+}
+
+struct LinePool {
+    const LineQuery* q;
+    pthread_t* threads;
+    int nthreads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int busy;                   // workers still inside the current batch
+    int stop;
+
+    LineRequest* reqs;
+    size_t n;
+    atomic_size_t next;
+};
+
+static void serve(LinePool* pool) {
+    size_t i;
+
+    while ((i = atomic_fetch_add_explicit(&pool->next, POOL_CHUNK, memory_order_relaxed)) < pool->n) {
+        size_t end = i + POOL_CHUNK < pool->n ? i + POOL_CHUNK : pool->n;
+        for (; i < end; i++) {
+            LineRequest* r = &pool->reqs[i];
+            r->length = line_query_read(pool->q, r->line, r->buf, r->cap);
+            r->err = r->length == -1 ? errno : 0;
+        }
+    }
+}
+
+static void* pool_worker(void* arg) {
+    LinePool* pool = arg;
+    unsigned long seen = 0;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        serve(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+LinePool* line_pool_create(const LineQuery* q, int threads) {
+    LinePool* pool = calloc(1, sizeof(*pool));
+
+    if (pool == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    pool->q = q;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next, 0);
+
+    if (threads > 0) {
+        pool->threads = malloc(threads * sizeof(pthread_t));
+        if (pool->threads == NULL) {
+            perror("malloc");
+            line_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, pool_worker, pool);
+        if (err != 0) {
+            errno = err;
+            perror("pthread_create");
+            line_pool_destroy(pool);
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+void line_pool_run(LinePool* pool, LineRequest* reqs, size_t n) {
+    pthread_mutex_lock(&pool->lock);
+    pool->reqs = reqs;
+    pool->n = n;
+    atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+    pool->busy = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    serve(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void line_pool_destroy(LinePool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
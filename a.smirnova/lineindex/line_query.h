@@ -0,0 +1,64 @@
+#ifndef LINE_QUERY_H
+#define LINE_QUERY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reentrant lookups against a finished line table.
+ *
+ * A LineQuery is never written after line_query_init, so one instance can
+ * be shared read-only by any number of threads. Lines are fetched with
+ * pread, which takes its own offset and leaves the descriptor's file
+ * position alone, or copied out of a mapping when data is not NULL.
+ */
+typedef struct {
+    int fd;
+    const char* data;
+    const Line* lines;
+    size_t cnt;
+} LineQuery;
+
+void line_query_init(LineQuery* q, int fd, const char* data, const Array* table);
+
+// pread until len bytes are in or EOF; bytes read, or -1
+ssize_t line_pread(int fd, char* buf, size_t len, off_t offset);
+
+/*
+ * Copy zero-based line n into buf, NUL-terminated and cut to cap - 1
+ * bytes. Returns the full length of the line, so a result >= cap means it
+ * was cut, or -1 with errno set (ERANGE for a line that does not exist).
+ */
+ssize_t line_query_read(const LineQuery* q, size_t n, char* buf, size_t cap);
+
+/*
+ * Worker pool serving batches of lookups. line_pool_run hands the batch
+ * out in small chunks to the pool's threads and the calling thread and
+ * returns once every request is answered.
+ */
+typedef struct {
+    size_t line;        // in: zero-based line number
+    char* buf;          // in: where the line goes, see line_query_read
+    size_t cap;
+    ssize_t length;     // out: line_query_read result
+    int err;            // out: errno when length is -1
+} LineRequest;
+
+typedef struct LinePool LinePool;
+
+// threads extra workers besides the caller; 0 serves everything inline
+LinePool* line_pool_create(const LineQuery* q, int threads);
+void line_pool_run(LinePool* pool, LineRequest* reqs, size_t n);
+void line_pool_destroy(LinePool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,435 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_sort.h"
+
+// More runs than this and the batches grow past the memory budget
+#define MAX_RUNS 512
+#define MAX_THREADS 64
+// Stdio buffer per run, shrunk to fit the memory budget but not below
+// MIN_RUN_BUFFER
+#define RUN_BUFFER (1 << 16)
+#define MIN_RUN_BUFFER (1 << 12)
+
+struct sort_entry {
+    uint64_t prefix;            // first 8 key bytes, big-endian
+    double number;
+    const char* key;
+    size_t key_len;
+    Line line;
+};
+
+struct sort_ctx {
+    const SortOptions* opt;
+    const char* data;
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// The key field of a line, empty if the line has fewer fields
+static const char* find_field(const char* p, size_t len, const SortOptions* opt, size_t* key_len) {
+    const char* end = p + len;
+
+    if (opt->field <= 0) {
+        *key_len = len;
+        return p;
+    }
+    for (int f = 1; ; f++) {
+        const char* start;
+        if (opt->delim != 0) {
+            start = p;
+            const char* stop = memchr(p, opt->delim, end - p);
+            p = stop != NULL ? stop : end;
+        } else {
+            while (p < end && is_blank(*p)) {
+                p++;
+            }
+            start = p;
+            while (p < end && !is_blank(*p)) {
+                p++;
+            }
+        }
+        if (f == opt->field) {
+            *key_len = p - start;
+            return start;
+        }
+        if (p == end) {
+            *key_len = 0;
+            return end;
+        }
+        if (opt->delim != 0) {
+            p++;
+        }
+    }
+}
+
+// Leading blanks, '-', digits and fraction; anything else counts as 0.
+// Like sort -n, a '+' is not a sign, so "+4" is 0 as well.
+static double parse_number(const char* p, size_t len) {
+    const char* end = p + len;
+    double value = 0, scale = 1;
+    int negative = 0;
+
+    while (p < end && is_blank(*p)) {
+        p++;
+    }
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            scale /= 10;
+            value += (*p - '0') * scale;
+        }
+    }
+    return negative ? -value : value;
+}
+
+static void make_entry(const struct sort_ctx* ctx, Line line, struct sort_entry* e) {
+    e->line = line;
+    e->key = find_field(ctx->data + line.offset, line.length, ctx->opt, &e->key_len);
+    e->prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        e->prefix = (e->prefix << 8) | (i < e->key_len ? (unsigned char)e->key[i] : 0);
+    }
+    e->number = ctx->opt->kind == SORT_NUMERIC ? parse_number(e->key, e->key_len) : 0;
+}
+
+static int compare_bytes(const char* a, size_t a_len, const char* b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) {
+        return c;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static inline int compare_entries(const void* pa, const void* pb, void* arg) {
+    const struct sort_entry* a = pa;
+    const struct sort_entry* b = pb;
+    const struct sort_ctx* ctx = arg;
+    int c;
+
+    if (ctx->opt->kind == SORT_NUMERIC) {
+        c = (a->number > b->number) - (a->number < b->number);
+    } else if (a->prefix != b->prefix) {
+        c = a->prefix < b->prefix ? -1 : 1;
+    } else {
+        c = compare_bytes(a->key, a->key_len, b->key, b->key_len);
+    }
+    // Equal keys fall back to the whole line, then to file order
+    if (c == 0 && (ctx->opt->kind == SORT_NUMERIC || ctx->opt->field > 0)) {
+        c = compare_bytes(ctx->data + a->line.offset, a->line.length,
+                          ctx->data + b->line.offset, b->line.length);
+    }
+    if (c != 0) {
+        return ctx->opt->reverse ? -c : c;
+    }
+    return (a->line.offset > b->line.offset) - (a->line.offset < b->line.offset);
+}
+
+static void insertion_sort(const struct sort_ctx* ctx, struct sort_entry* a, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        struct sort_entry e = a[i];
+        size_t j = i;
+        while (j > 0 && compare_entries(&a[j - 1], &e, (void*)ctx) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = e;
+    }
+}
+
+// Stable merge sort with the comparison inlined; qsort_r pays an indirect
+// call per comparison, which dominates on short keys
+static void merge_sort(const struct sort_ctx* ctx, struct sort_entry* a, size_t n, struct sort_entry* tmp) {
+    if (n <= 16) {
+        insertion_sort(ctx, a, n);
+        return;
+    }
+    size_t half = n / 2;
+    merge_sort(ctx, a, half, tmp);
+    merge_sort(ctx, a + half, n - half, tmp);
+    if (compare_entries(&a[half - 1], &a[half], (void*)ctx) <= 0) {
+        return;
+    }
+    memcpy(tmp, a, half * sizeof(*a));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n) {
+        if (compare_entries(&a[j], &tmp[i], (void*)ctx) < 0) {
+            a[k++] = a[j++];
+        } else {
+            a[k++] = tmp[i++];
+        }
+    }
+    memcpy(a + k, tmp + i, (half - i) * sizeof(*a));
+}
+
+struct slice_job {
+    const struct sort_ctx* ctx;
+    const Line* lines;
+    struct sort_entry* entries;
+    struct sort_entry* tmp;
+    size_t n;
+};
+
+static void* sort_slice(void* arg) {
+    struct slice_job* job = arg;
+
+    for (size_t i = 0; i < job->n; i++) {
+        make_entry(job->ctx, job->lines[i], &job->entries[i]);
+    }
+    merge_sort(job->ctx, job->entries, job->n, job->tmp);
+    return NULL;
+}
+
+// Key and sort n lines as up to threads slices; bounds gets slices + 1 cuts
+static int sort_batch(const struct sort_ctx* ctx, const Line* lines, size_t n,
+                      struct sort_entry* entries, struct sort_entry* tmp, size_t* bounds) {
+    struct slice_job jobs[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    int slices = ctx->opt->threads;
+
+    if ((size_t)slices > n) {
+        slices = n > 0 ? (int)n : 1;
+    }
+    for (int t = 0; t <= slices; t++) {
+        bounds[t] = n * t / slices;
+    }
+    for (int t = 0; t < slices; t++) {
+        jobs[t].ctx = ctx;
+        jobs[t].lines = lines + bounds[t];
+        jobs[t].entries = entries + bounds[t];
+        jobs[t].tmp = tmp + bounds[t] / 2 + t;
+        jobs[t].n = bounds[t + 1] - bounds[t];
+    }
+    // The calling thread takes the first slice
+    int started = 1;
+    for (; started < slices; started++) {
+        if (pthread_create(&threads[started], NULL, sort_slice, &jobs[started]) != 0) {
+            break;
+        }
+    }
+    sort_slice(&jobs[0]);
+    for (int t = started; t < slices; t++) {
+        sort_slice(&jobs[t]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    return slices;
+}
+
+// A sorted sequence to merge: a slice in memory or a run on disk
+struct source {
+    struct sort_entry cur;
+    const struct sort_entry* next;
+    const struct sort_entry* end;
+    FILE* run;
+};
+
+// 1 with cur set, 0 when the source is exhausted, -1 on a read error
+static int source_advance(const struct sort_ctx* ctx, struct source* s) {
+    if (s->run == NULL) {
+        if (s->next == s->end) {
+            return 0;
+        }
+        s->cur = *s->next++;
+        return 1;
+    }
+    Line line;
+    if (fread(&line, sizeof(line), 1, s->run) != 1) {
+        return ferror(s->run) ? -1 : 0;
+    }
+    make_entry(ctx, line, &s->cur);
+    return 1;
+}
+
+static void sift_down(const struct sort_ctx* ctx, struct source** heap, size_t n, size_t i) {
+    while (1) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && compare_entries(&heap[l]->cur, &heap[least]->cur, (void*)ctx) < 0) {
+            least = l;
+        }
+        if (r < n && compare_entries(&heap[r]->cur, &heap[least]->cur, (void*)ctx) < 0) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+        struct source* t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+/*
+ * k-way merge of the sources. With raw set the Line entries go to out (a
+ * run), otherwise the lines themselves, one per output line.
+ */
+static int merge(const struct sort_ctx* ctx, struct source* sources, size_t k, FILE* out, int raw) {
+    struct source** heap = malloc(k * sizeof(*heap));
+    size_t n = 0;
+    int rc;
+
+    if (heap == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    for (size_t i = 0; i < k; i++) {
+        if ((rc = source_advance(ctx, &sources[i])) == -1) {
+            free(heap);
+            return -1;
+        }
+        if (rc == 1) {
+            heap[n++] = &sources[i];
+        }
+    }
+    for (size_t i = n / 2; i-- > 0; ) {
+        sift_down(ctx, heap, n, i);
+    }
+    while (n > 0) {
+        const Line* line = &heap[0]->cur.line;
+        if (raw) {
+            fwrite(line, sizeof(*line), 1, out);
+        } else {
+            fwrite(ctx->data + line->offset, 1, line->length, out);
+            putc('\n', out);
+        }
+        if ((rc = source_advance(ctx, heap[0])) == -1) {
+            free(heap);
+            return -1;
+        }
+        if (rc == 0) {
+            heap[0] = heap[--n];
+        }
+        sift_down(ctx, heap, n, 0);
+    }
+    free(heap);
+    return ferror(out) ? -1 : 0;
+}
+
+static void slice_sources(struct sort_entry* entries, const size_t* bounds, int slices,
+                          struct source* sources) {
+    for (int t = 0; t < slices; t++) {
+        sources[t].next = entries + bounds[t];
+        sources[t].end = entries + bounds[t + 1];
+        sources[t].run = NULL;
+    }
+}
+
+int line_sort(const char* data, const Array* table, const SortOptions* opt, FILE* out) {
+    SortOptions options = *opt;
+    struct sort_ctx ctx = { &options, data };
+    struct source slices[MAX_THREADS];
+    size_t bounds[MAX_THREADS + 1];
+    size_t n = table->cnt;
+    // Entries plus the merge sort's scratch half
+    const size_t entry_bytes = sizeof(struct sort_entry) * 3 / 2;
+    size_t batch = options.memory / entry_bytes;
+    size_t run_buffer = RUN_BUFFER;
+    int rc = -1;
+
+    if (options.threads < 1) {
+        options.threads = 1;
+    }
+    if (options.threads > MAX_THREADS) {
+        options.threads = MAX_THREADS;
+    }
+    if (n > batch) {
+        // Spilling: a quarter of the budget goes to the run buffers, which
+        // are all live while the runs are written and merged
+        batch = (options.memory - options.memory / 4) / entry_bytes;
+        if (batch == 0) {
+            batch = 1;
+        }
+        if (n > batch * MAX_RUNS) {
+            batch = (n + MAX_RUNS - 1) / MAX_RUNS;
+        }
+        size_t nruns = (n + batch - 1) / batch;
+        run_buffer = options.memory / 4 / nruns;
+        if (run_buffer > RUN_BUFFER) {
+            run_buffer = RUN_BUFFER;
+        }
+        if (run_buffer < MIN_RUN_BUFFER) {
+            run_buffer = MIN_RUN_BUFFER;
+        }
+    }
+
+    size_t cap = n < batch ? n : batch;
+    struct sort_entry* entries = malloc(cap * sizeof(*entries) + 1);
+    // Each slice merges through half its length of scratch
+    struct sort_entry* tmp = malloc((cap / 2 + MAX_THREADS) * sizeof(*tmp));
+    if (entries == NULL || tmp == NULL) {
+        perror("malloc");
+        free(entries);
+        free(tmp);
+        return -1;
+    }
+
+    // Everything fits: sort the slices and merge them straight to out
+    if (n <= batch) {
+        int k = sort_batch(&ctx, table->array, n, entries, tmp, bounds);
+        free(tmp);
+        slice_sources(entries, bounds, k, slices);
+        rc = merge(&ctx, slices, k, out, 0);
+        free(entries);
+        return rc;
+    }
+
+    size_t nruns = (n + batch - 1) / batch;
+    struct source* runs = calloc(nruns, sizeof(*runs));
+    char* buffers = malloc(nruns * run_buffer);
+    if (runs == NULL || buffers == NULL) {
+        perror("malloc");
+        goto out;
+    }
+    for (size_t r = 0; r < nruns; r++) {
+        size_t first = r * batch;
+        size_t count = n - first < batch ? n - first : batch;
+        int k = sort_batch(&ctx, table->array + first, count, entries, tmp, bounds);
+
+        // Removed by the system as soon as it is closed
+        runs[r].run = tmpfile();
+        if (runs[r].run == NULL) {
+            perror("tmpfile");
+            goto out;
+        }
+        setvbuf(runs[r].run, buffers + r * run_buffer, _IOFBF, run_buffer);
+        slice_sources(entries, bounds, k, slices);
+        if (merge(&ctx, slices, k, runs[r].run, 1) == -1 || fflush(runs[r].run) != 0) {
+            perror("run");
+            goto out;
+        }
+        rewind(runs[r].run);
+    }
+    // The entries are rebuilt from the runs, the batch buffer can go
+    free(entries);
+    free(tmp);
+    entries = tmp = NULL;
+    rc = merge(&ctx, runs, nruns, out, 0);
+
+out:
+    if (runs != NULL) {
+        for (size_t r = 0; r < nruns; r++) {
+            if (runs[r].run != NULL) {
+                fclose(runs[r].run);
+            }
+        }
+    }
+    free(runs);
+    free(buffers);
+    free(entries);
+    free(tmp);
+    return rc;
+}
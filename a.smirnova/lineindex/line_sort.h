@@ -0,0 +1,48 @@
+#ifndef LINE_SORT_H
+#define LINE_SORT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sort the lines of a mapped file by sorting their index entries; the
+ * bytes are only touched to compare keys and to write the result.
+ *
+ * Slices of the table are keyed and sorted on separate threads and then
+ * merged with a k-way heap. When the entries do not fit the memory budget
+ * every budget-sized batch is sorted that way into a run on disk (just
+ * the Line entries, keys are recomputed from the mapping) and the runs
+ * are merged. Ties keep file order, so the sort is stable.
+ */
+
+typedef enum {
+    SORT_BYTES,         // memcmp order, like LC_ALL=C sort
+    SORT_NUMERIC        // leading decimal number, like sort -n
+} SortKeyKind;
+
+typedef struct {
+    SortKeyKind kind;
+    int field;          // 1-based key field, 0 for the whole line
+    char delim;         // field separator, 0 for runs of blanks
+    int reverse;
+    int threads;
+    size_t memory;      // bytes for the entries, sort scratch and run buffers
+} SortOptions;
+
+#define SORT_OPTIONS_DEFAULT { SORT_BYTES, 0, 0, 0, 1, (size_t)256 << 20 }
+
+// Write the lines of table (over data) to out in sorted order, each
+// followed by '\n'; 0, or -1 if the sort or a temporary run failed
+int line_sort(const char* data, const Array* table, const SortOptions* opt, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
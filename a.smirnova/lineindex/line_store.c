@@ -0,0 +1,510 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "line_store.h"
+
+// Chunks are 16 KiB .. 256 KiB, about 80 KiB on average
+#define CHUNK_MIN (16 << 10)
+#define CHUNK_MAX (256 << 10)
+#define CHUNK_MASK 0xffffULL
+
+static const char store_magic[8] = "LIDX\0\0\0\1";
+
+struct store_header {
+    char magic[8];
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t chunks;
+    uint64_t newlines;          // entries in the ends array
+};
+
+struct store_chunk {
+    uint64_t hash;
+    uint32_t length;
+    uint32_t lines;             // lines whose '\n' is in this chunk
+};
+
+// The previous index as loaded from the sidecar
+struct old_index {
+    struct store_header header;
+    struct store_chunk* chunks;
+    uint64_t* offsets;          // file offset of each chunk
+    uint64_t* first_end;        // index of each chunk's first entry in ends
+    uint32_t* ends;             // '\n' offsets, relative to their chunk
+    uint32_t* slots;            // open addressing on hash, chunk + 1 or 0
+    size_t nslots;
+};
+
+// The sidecar write a first build leaves running, see line_store_wait
+struct pending_save {
+    pthread_t thread;
+    int active;
+    int rc;
+    char* path;
+    const unsigned char* data;
+    size_t size;
+    const Line* lines;
+    size_t nlines;
+    struct store_header header;
+};
+
+static struct pending_save pending;
+
+static uint64_t gear[256];
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Fixed seed: cut points must not change between runs
+static void gear_init(void) {
+    uint64_t state = 0x6c696e6573746f72ULL;
+
+    if (gear[0] != 0) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+        gear[i] = splitmix64(&state);
+    }
+}
+
+// Length of the chunk starting at data
+static size_t cut_chunk(const unsigned char* data, size_t size) {
+    size_t limit = size < CHUNK_MAX ? size : CHUNK_MAX;
+    uint64_t h = 0;
+    size_t i;
+
+    if (size <= CHUNK_MIN) {
+        return size;
+    }
+    for (i = CHUNK_MIN; i < limit; i++) {
+        h = (h << 1) + gear[data[i]];
+        if ((h & CHUNK_MASK) == 0) {
+            break;
+        }
+    }
+    // End the chunk on a line boundary when there is one before the limit
+    const unsigned char* nl = memchr(data + i, '\n', limit - i);
+    return nl != NULL ? (size_t)(nl - data) + 1 : limit;
+}
+
+// Word-at-a-time multiply-xorshift, fast enough to run at memory speed
+static uint64_t chunk_hash(const unsigned char* data, size_t len) {
+    uint64_t h = 0x243f6a8885a308d3ULL ^ len;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0x9fb21c651e98df25ULL;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, len - i);
+        h = (h ^ w) * 0x9fb21c651e98df25ULL;
+        h ^= h >> 29;
+    }
+    return h ^ (h >> 32);
+}
+
+static int reserve_lines(Array* a, size_t more) {
+    if (a->cnt + more > a->cap) {
+        size_t cap = a->cap ? a->cap : 16;
+        while (cap < a->cnt + more) {
+            cap *= 2;
+        }
+        Line* array = realloc(a->array, cap * sizeof(Line));
+        if (array == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        a->array = array;
+        a->cap = cap;
+    }
+    return 0;
+}
+
+static char* sidecar_path(const char* path, const char* suffix) {
+    size_t len = strlen(path) + strlen(suffix) + 1;
+    char* out = malloc(len);
+
+    if (out != NULL) {
+        snprintf(out, len, "%s%s", path, suffix);
+    }
+    return out;
+}
+
+static void old_index_free(struct old_index* old) {
+    free(old->chunks);
+    free(old->offsets);
+    free(old->first_end);
+    free(old->ends);
+    free(old->slots);
+    memset(old, 0, sizeof(*old));
+}
+
+static int old_index_load(const char* path, struct old_index* old) {
+    char* name = sidecar_path(path, ".lidx");
+    FILE* f = name != NULL ? fopen(name, "rb") : NULL;
+    struct store_header* h = &old->header;
+    int rc = -1;
+
+    memset(old, 0, sizeof(*old));
+    free(name);
+    if (f == NULL) {
+        return -1;
+    }
+    if (fread(h, sizeof(*h), 1, f) != 1 || memcmp(h->magic, store_magic, sizeof(store_magic)) != 0 ||
+        h->chunks > h->file_size || h->chunks > UINT32_MAX - 1 || h->newlines > h->file_size) {
+        goto out;
+    }
+    old->chunks = malloc((h->chunks + 1) * sizeof(*old->chunks));
+    old->offsets = malloc((h->chunks + 1) * sizeof(*old->offsets));
+    old->first_end = malloc((h->chunks + 1) * sizeof(*old->first_end));
+    old->ends = malloc((h->newlines + 1) * sizeof(*old->ends));
+    if (old->chunks == NULL || old->offsets == NULL || old->first_end == NULL || old->ends == NULL ||
+        fread(old->chunks, sizeof(*old->chunks), h->chunks, f) != h->chunks ||
+        fread(old->ends, sizeof(*old->ends), h->newlines, f) != h->newlines) {
+        goto out;
+    }
+
+    // Chunks must tile the old file and hold every newline, in order
+    uint64_t offset = 0, end = 0;
+    for (uint64_t i = 0; i < h->chunks; i++) {
+        old->offsets[i] = offset;
+        old->first_end[i] = end;
+        offset += old->chunks[i].length;
+        if (old->chunks[i].lines > h->newlines - end) {
+            goto out;
+        }
+        for (uint32_t k = 0; k < old->chunks[i].lines; k++, end++) {
+            if (old->ends[end] >= old->chunks[i].length ||
+                (k > 0 && old->ends[end] <= old->ends[end - 1])) {
+                goto out;
+            }
+        }
+    }
+    if (offset != h->file_size || end != h->newlines) {
+        goto out;
+    }
+
+    old->nslots = 16;
+    while (old->nslots < h->chunks * 2) {
+        old->nslots *= 2;
+    }
+    old->slots = calloc(old->nslots, sizeof(*old->slots));
+    if (old->slots == NULL) {
+        goto out;
+    }
+    for (uint32_t i = 0; i < h->chunks; i++) {
+        size_t s = old->chunks[i].hash & (old->nslots - 1);
+        while (old->slots[s] != 0) {
+            s = (s + 1) & (old->nslots - 1);
+        }
+        old->slots[s] = i + 1;
+    }
+    rc = 0;
+
+out:
+    fclose(f);
+    if (rc == -1) {
+        old_index_free(old);
+    }
+    return rc;
+}
+
+// Old chunk with this fingerprint and length, or -1
+static long old_index_find(const struct old_index* old, uint64_t hash, size_t len) {
+    if (old->slots == NULL) {
+        return -1;
+    }
+    for (size_t s = hash & (old->nslots - 1); old->slots[s] != 0; s = (s + 1) & (old->nslots - 1)) {
+        const struct store_chunk* c = &old->chunks[old->slots[s] - 1];
+        if (c->hash == hash && c->length == len) {
+            return old->slots[s] - 1;
+        }
+    }
+    return -1;
+}
+
+// The sidecar holds the newlines, not the table: 4 bytes a line instead of
+// 16, and the table is cheap to rebuild from them
+static int store_save(const char* path, const struct store_header* h,
+                      const struct store_chunk* chunks, const Line* lines) {
+    char* name = sidecar_path(path, ".lidx");
+    char* tmp = sidecar_path(path, ".lidx.tmp");
+    FILE* f = tmp != NULL ? fopen(tmp, "wb") : NULL;
+    uint32_t ends[4096];
+    int rc = -1;
+
+    if (f != NULL) {
+        if (fwrite(h, sizeof(*h), 1, f) == 1 &&
+            (h->chunks == 0 || fwrite(chunks, sizeof(*chunks), h->chunks, f) == h->chunks)) {
+            size_t n = 0;
+            off_t offset = 0;
+            rc = 0;
+            for (uint64_t i = 0; i < h->chunks && rc == 0; i++) {
+                for (uint32_t k = 0; k < chunks[i].lines; k++, lines++) {
+                    ends[n++] = (uint32_t)(lines->offset + lines->length - offset);
+                    if (n == sizeof(ends) / sizeof(ends[0])) {
+                        rc = fwrite(ends, sizeof(ends[0]), n, f) == n ? 0 : -1;
+                        n = 0;
+                    }
+                }
+                offset += chunks[i].length;
+            }
+            if (rc == 0 && fwrite(ends, sizeof(ends[0]), n, f) != n) {
+                rc = -1;
+            }
+        }
+        if (fclose(f) != 0) {
+            rc = -1;
+        }
+        // Replace the old sidecar in one step, a reader never sees half of it
+        if (rc == 0 && rename(tmp, name) == -1) {
+            rc = -1;
+        }
+        if (rc == -1) {
+            unlink(tmp);
+        }
+    }
+    free(name);
+    free(tmp);
+    return rc;
+}
+
+// Cut and fingerprint a file indexed without a sidecar, then save. The
+// lines are already in the table, so only the chunk records are new
+static void* save_first_build(void* arg) {
+    struct pending_save* ps = arg;
+    struct store_chunk* chunks = NULL;
+    size_t nchunks = 0, cap = 0;
+    const Line* line = ps->lines;
+    const Line* last = ps->lines + ps->nlines;
+
+    ps->rc = -1;
+    gear_init();
+    for (size_t pos = 0; pos < ps->size; ) {
+        size_t len = cut_chunk(ps->data + pos, ps->size - pos);
+        if (nchunks == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            struct store_chunk* grown = realloc(chunks, new_cap * sizeof(*chunks));
+            if (grown == NULL) {
+                goto out;
+            }
+            chunks = grown;
+            cap = new_cap;
+        }
+        chunks[nchunks].hash = chunk_hash(ps->data + pos, len);
+        chunks[nchunks].length = len;
+        chunks[nchunks].lines = 0;
+        // The last line has no '\n' and so ends in no chunk
+        while (line < last && (size_t)(line->offset + line->length) < pos + len) {
+            chunks[nchunks].lines++;
+            line++;
+        }
+        nchunks++;
+        pos += len;
+    }
+    ps->header.chunks = nchunks;
+    ps->header.newlines = line - ps->lines;
+    ps->rc = store_save(ps->path, &ps->header, chunks, ps->lines);
+
+out:
+    free(chunks);
+    free(ps->path);
+    ps->path = NULL;
+    return NULL;
+}
+
+int line_store_wait(void) {
+    if (pending.active) {
+        pthread_join(pending.thread, NULL);
+        pending.active = 0;
+    }
+    return pending.rc;
+}
+
+// Append the lines ending in old chunk j, which now starts at pos
+static int reuse_chunk(const struct old_index* old, size_t j, off_t pos,
+                       off_t* line_start, Array* table) {
+    uint32_t count = old->chunks[j].lines;
+    const uint32_t* ends = old->ends + old->first_end[j];
+
+    if (reserve_lines(table, count) == -1) {
+        return -1;
+    }
+    Line* dst = table->array + table->cnt;
+    for (uint32_t k = 0; k < count; k++) {
+        off_t end = pos + ends[k];
+        dst[k].offset = *line_start;
+        dst[k].length = end - *line_start;
+        *line_start = end + 1;
+    }
+    table->cnt += count;
+    return 0;
+}
+
+int line_store_update(const char* path, int fd, const char* data, size_t size,
+                      Array* table, LineStoreStats* stats) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    struct old_index old;
+    struct store_header header;
+    struct store_chunk* chunks = NULL;
+    size_t nchunks = 0, cap = 0, next_old = 0, first_line = table->cnt;
+    off_t line_start = 0;
+    struct stat st;
+    int rc = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    line_store_wait();
+    pending.rc = 0;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, store_magic, sizeof(store_magic));
+    header.file_size = size;
+    header.mtime_sec = st.st_mtim.tv_sec;
+    header.mtime_nsec = st.st_mtim.tv_nsec;
+
+    int have_old = old_index_load(path, &old) == 0;
+    if (have_old && old.header.file_size == header.file_size &&
+        old.header.mtime_sec == header.mtime_sec && old.header.mtime_nsec == header.mtime_nsec) {
+        for (size_t j = 0; j < old.header.chunks; j++) {
+            if (reuse_chunk(&old, j, old.offsets[j], &line_start, table) == -1) {
+                old_index_free(&old);
+                return -1;
+            }
+        }
+        if ((off_t)size > line_start) {
+            Line current = { line_start, (off_t)size - line_start };
+            if (insertArray(table, current) == -1) {
+                old_index_free(&old);
+                return -1;
+            }
+        }
+        stats->chunks = stats->reused = old.header.chunks;
+        stats->unchanged = 1;
+        old_index_free(&old);
+        return 0;
+    }
+
+    // Nothing to reuse: a plain newline scan builds the table, and the
+    // chunking, fingerprints and sidecar, which cost more than the scan,
+    // are left to a thread
+    if (!have_old) {
+        if (build_line_table_mem(data, size, table) == -1) {
+            return -1;
+        }
+        stats->first_build = 1;
+        stats->rescanned_bytes = size;
+        pending.path = strdup(path);
+        pending.data = bytes;
+        pending.size = size;
+        pending.lines = table->array + first_line;
+        pending.nlines = table->cnt - first_line;
+        pending.header = header;
+        if (pending.path == NULL) {
+            pending.rc = -1;
+        } else if (pthread_create(&pending.thread, NULL, save_first_build, &pending) == 0) {
+            pending.active = 1;
+        } else {
+            save_first_build(&pending);
+        }
+        return 0;
+    }
+
+    gear_init();
+    for (size_t pos = 0; pos < size; ) {
+        size_t first = table->cnt, len;
+        uint64_t hash;
+        long j = -1;
+
+        // While nothing has changed the old chunks are simply verified in
+        // place; the gear hash only runs from the first mismatch until a
+        // chunk is recognised again, wherever the edit moved it
+        if (next_old < old.header.chunks && old.chunks[next_old].length <= size - pos) {
+            len = old.chunks[next_old].length;
+            hash = chunk_hash(bytes + pos, len);
+            if (hash == old.chunks[next_old].hash) {
+                j = next_old;
+            }
+        }
+        if (j < 0) {
+            len = cut_chunk(bytes + pos, size - pos);
+            hash = chunk_hash(bytes + pos, len);
+            j = have_old ? old_index_find(&old, hash, len) : -1;
+        }
+
+        if (j >= 0) {
+            // Same bytes as an old chunk: its newlines moved with it
+            if (reuse_chunk(&old, j, pos, &line_start, table) == -1) {
+                goto out;
+            }
+            next_old = j + 1;
+            stats->reused++;
+        } else {
+            const unsigned char* p = bytes + pos;
+            const unsigned char* end = bytes + pos + len;
+            const unsigned char* nl;
+            while ((nl = memchr(p, '\n', end - p)) != NULL) {
+                Line current = { line_start, (off_t)(nl - bytes) - line_start };
+                if (insertArray(table, current) == -1) {
+                    goto out;
+                }
+                line_start = nl - bytes + 1;
+                p = nl + 1;
+            }
+            next_old = SIZE_MAX;
+            stats->rescanned_bytes += len;
+        }
+
+        if (nchunks == cap) {
+            size_t new_cap = cap ? cap * 2 : 64;
+            struct store_chunk* grown = realloc(chunks, new_cap * sizeof(*chunks));
+            if (grown == NULL) {
+                perror("realloc");
+                goto out;
+            }
+            chunks = grown;
+            cap = new_cap;
+        }
+        chunks[nchunks].hash = hash;
+        chunks[nchunks].length = len;
+        chunks[nchunks].lines = table->cnt - first;
+        header.newlines += chunks[nchunks].lines;
+        nchunks++;
+        pos += len;
+    }
+    if ((off_t)size > line_start) {
+        Line current = { line_start, (off_t)size - line_start };
+        if (insertArray(table, current) == -1) {
+            goto out;
+        }
+    }
+
+    stats->chunks = nchunks;
+    header.chunks = nchunks;
+    pending.rc = store_save(path, &header, chunks, table->array + first_line);
+    rc = 0;
+
+out:
+    if (have_old) {
+        old_index_free(&old);
+    }
+    free(chunks);
+    return rc;
+}
@@ -0,0 +1,64 @@
+#ifndef LINE_STORE_H
+#define LINE_STORE_H
+
+#include <stddef.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Persistent line index with incremental re-indexing ('\n' lines only).
+ *
+ * The file is cut into content-defined chunks: a gear rolling hash picks
+ * cut points from the bytes themselves, each moved forward to the next
+ * '\n', so an edit only moves the boundaries next to it.
+ *
+ * <file>.lidx holds a header (file size, mtime, chunk and newline counts),
+ * one record per chunk (64-bit fingerprint, length, lines ending in it)
+ * and then, chunk after chunk, the end of each of those lines as a u32
+ * offset from the start of its chunk. The line table itself is not
+ * stored; it is rebuilt from those ends.
+ *
+ * On the next open an unchanged size and mtime rebuild the table from the
+ * sidecar without reading the file. Otherwise the file is cut again and
+ * every chunk whose fingerprint is known takes its line ends from the
+ * sidecar, shifted to the chunk's new offset; only the chunks that changed
+ * are scanned for newlines.
+ *
+ * Without a usable sidecar there is nothing to reuse, so the table comes
+ * from a plain newline scan and the chunks are cut, fingerprinted and
+ * saved by a background thread; line_store_wait collects it.
+ */
+
+typedef struct {
+    size_t chunks;              // chunks in the file now
+    size_t reused;              // of those, found in the old index
+    size_t rescanned_bytes;     // bytes scanned for newlines
+    int unchanged;              // size and mtime matched, nothing was read
+    int first_build;            // no usable path.lidx, plain scan
+} LineStoreStats;
+
+/*
+ * Fill table with the lines of path, whose contents are data/size (e.g.
+ * its mapping) and which is open as fd, using and then refreshing
+ * path.lidx. A missing or damaged sidecar just means a full scan; failing
+ * to write it is not an error either, line_store_wait reports it.
+ *
+ * After a first build data and the new lines in table are still read by
+ * the background save: keep them until line_store_wait.
+ */
+int line_store_update(const char* path, int fd, const char* data, size_t size,
+                      Array* table, LineStoreStats* stats);
+
+// Wait for the sidecar write of the last update; 0, or -1 if path.lidx
+// could not be written
+int line_store_wait(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,543 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "word_index.h"
+
+static const char widx_magic[8] = "WIDX\0\0\0\1";
+
+struct widx_header {
+    char magic[8];
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t terms;
+    uint64_t nslots;            // power of two, empty slots have term_len 0
+    uint64_t pool_size;
+};
+
+struct widx_slot {
+    uint64_t hash;
+    uint64_t term_off;          // offsets into the pool after the slots
+    uint64_t post_off;
+    uint32_t post_len;
+    uint32_t term_len;
+    uint32_t count;             // postings, i.e. lines
+    uint32_t reserved;
+};
+
+// A term while building: its postings grow as a byte buffer
+struct term_entry {
+    uint64_t hash;
+    size_t term_off;
+    uint32_t term_len;
+    uint32_t count;
+    size_t last_line;
+    off_t last_offset;
+    unsigned char* post;
+    size_t post_len;
+    size_t post_cap;
+};
+
+struct builder {
+    struct term_entry* map;     // open addressing, term_len 0 = empty
+    size_t nslots;
+    size_t terms;
+    char* pool;                 // term bytes
+    size_t pool_len;
+    size_t pool_cap;
+};
+
+static uint64_t term_hash(const unsigned char* p, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// One code point at p; its length, or 0 for an invalid or cut sequence
+static size_t utf8_decode(const unsigned char* p, const unsigned char* end, uint32_t* cp) {
+    size_t n;
+    uint32_t c = p[0];
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c >= 0xc2 && c < 0xe0) {
+        n = 2;
+        c &= 0x1f;
+    } else if (c >= 0xe0 && c < 0xf0) {
+        n = 3;
+        c &= 0x0f;
+    } else if (c >= 0xf0 && c < 0xf5) {
+        n = 4;
+        c &= 0x07;
+    } else {
+        return 0;
+    }
+    if ((size_t)(end - p) < n) {
+        return 0;
+    }
+    for (size_t i = 1; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        c = (c << 6) | (p[i] & 0x3f);
+    }
+    // Overlong forms and surrogates
+    if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+        (c >= 0xd800 && c < 0xe000)) {
+        return 0;
+    }
+    *cp = c;
+    return n;
+}
+
+static size_t utf8_encode(uint32_t c, unsigned char* out) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xc0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3f);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xe0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3f);
+        out[2] = 0x80 | (c & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3f);
+    out[2] = 0x80 | ((c >> 6) & 0x3f);
+    out[3] = 0x80 | (c & 0x3f);
+    return 4;
+}
+
+// Letters and digits; outside ASCII, everything but the punctuation and
+// symbol blocks counts as a letter
+static int is_word_char(uint32_t c) {
+    if (c < 0x80) {
+        return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+    }
+    if (c < 0xc0 || c == 0xd7 || c == 0xf7) {
+        return 0;
+    }
+    if ((c >= 0x2000 && c < 0x2c00) || (c >= 0x3000 && c < 0x3040) ||
+        (c >= 0xfe30 && c < 0xfe70) || (c >= 0xff00 && c < 0xff10)) {
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t to_lower(uint32_t c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c + 0x20;
+    }
+    if (c >= 0x410 && c <= 0x42f) {         // А..Я
+        return c + 0x20;
+    }
+    if (c >= 0x400 && c <= 0x40f) {         // Ѐ..Џ, Ё among them
+        return c + 0x50;
+    }
+    if (c >= 0xc0 && c <= 0xde && c != 0xd7) {
+        return c + 0x20;
+    }
+    return c;
+}
+
+static int put_varint(struct term_entry* e, uint64_t v) {
+    if (e->post_len + 10 > e->post_cap) {
+        size_t cap = e->post_cap ? e->post_cap * 2 : 16;
+        unsigned char* post = realloc(e->post, cap);
+        if (post == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        e->post = post;
+        e->post_cap = cap;
+    }
+    while (v >= 0x80) {
+        e->post[e->post_len++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    e->post[e->post_len++] = (unsigned char)v;
+    return 0;
+}
+
+static const unsigned char* get_varint(const unsigned char* p, const unsigned char* end, uint64_t* v) {
+    uint64_t out = 0;
+
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        out |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            *v = out;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int builder_grow(struct builder* b) {
+    size_t nslots = b->nslots ? b->nslots * 2 : 1024;
+    struct term_entry* map = calloc(nslots, sizeof(*map));
+
+    if (map == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (size_t i = 0; i < b->nslots; i++) {
+        if (b->map[i].term_len != 0) {
+            size_t s = b->map[i].hash & (nslots - 1);
+            while (map[s].term_len != 0) {
+                s = (s + 1) & (nslots - 1);
+            }
+            map[s] = b->map[i];
+        }
+    }
+    free(b->map);
+    b->map = map;
+    b->nslots = nslots;
+    return 0;
+}
+
+static int add_term(struct builder* b, const unsigned char* term, size_t len, size_t line, off_t offset) {
+    uint64_t hash = term_hash(term, len);
+    size_t s = hash & (b->nslots - 1);
+    struct term_entry* e;
+
+    while ((e = &b->map[s])->term_len != 0) {
+        if (e->hash == hash && e->term_len == len && memcmp(b->pool + e->term_off, term, len) == 0) {
+            break;
+        }
+        s = (s + 1) & (b->nslots - 1);
+    }
+    if (e->term_len == 0) {
+        if (b->pool_len + len > b->pool_cap) {
+            size_t cap = b->pool_cap ? b->pool_cap * 2 : 65536;
+            char* pool = realloc(b->pool, cap);
+            if (pool == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            b->pool = pool;
+            b->pool_cap = cap;
+        }
+        memcpy(b->pool + b->pool_len, term, len);
+        e->hash = hash;
+        e->term_off = b->pool_len;
+        e->term_len = len;
+        b->pool_len += len;
+        // Keep the table at most half full
+        if (++b->terms * 2 > b->nslots && builder_grow(b) == -1) {
+            return -1;
+        }
+        return add_term(b, term, len, line, offset);
+    }
+    // Once per line
+    if (e->count > 0 && e->last_line == line) {
+        return 0;
+    }
+    if (put_varint(e, line - e->last_line) == -1 || put_varint(e, offset - e->last_offset) == -1) {
+        return -1;
+    }
+    e->count++;
+    e->last_line = line;
+    e->last_offset = offset;
+    return 0;
+}
+
+static int index_line(struct builder* b, const unsigned char* p, const unsigned char* end,
+                      size_t line, off_t offset) {
+    unsigned char term[WORD_TERM_MAX + 4];
+    size_t len = 0;
+
+    while (p < end) {
+        uint32_t c;
+        size_t n = utf8_decode(p, end, &c);
+        if (n == 0) {
+            c = 0;
+            n = 1;
+        }
+        p += n;
+        if (is_word_char(c)) {
+            // Long words are cut at a code point boundary
+            if (len + 4 <= WORD_TERM_MAX) {
+                len += utf8_encode(to_lower(c), term + len);
+            }
+        } else if (len > 0) {
+            if (add_term(b, term, len, line, offset) == -1) {
+                return -1;
+            }
+            len = 0;
+        }
+    }
+    if (len > 0) {
+        return add_term(b, term, len, line, offset);
+    }
+    return 0;
+}
+
+static char* widx_path(const char* path) {
+    size_t len = strlen(path) + sizeof(".widx");
+    char* out = malloc(len);
+
+    if (out != NULL) {
+        snprintf(out, len, "%s.widx", path);
+    }
+    return out;
+}
+
+static int builder_save(const struct builder* b, const char* path, const struct stat* st) {
+    struct widx_header h;
+    struct widx_slot* slots;
+    size_t nslots = 16;
+    uint64_t post_off = b->pool_len;
+    char* name = widx_path(path);
+    char* tmp = NULL;
+    FILE* f = NULL;
+    int rc = -1;
+
+    while (nslots < b->terms * 2) {
+        nslots *= 2;
+    }
+    slots = calloc(nslots, sizeof(*slots));
+    if (slots == NULL || name == NULL || (tmp = malloc(strlen(name) + 5)) == NULL) {
+        goto out;
+    }
+    for (size_t i = 0; i < b->nslots; i++) {
+        const struct term_entry* e = &b->map[i];
+        if (e->term_len == 0) {
+            continue;
+        }
+        size_t s = e->hash & (nslots - 1);
+        while (slots[s].term_len != 0) {
+            s = (s + 1) & (nslots - 1);
+        }
+        slots[s].hash = e->hash;
+        slots[s].term_off = e->term_off;
+        slots[s].term_len = e->term_len;
+        slots[s].post_off = post_off;
+        slots[s].post_len = e->post_len;
+        slots[s].count = e->count;
+        post_off += e->post_len;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, widx_magic, sizeof(widx_magic));
+    h.file_size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.terms = b->terms;
+    h.nslots = nslots;
+    h.pool_size = post_off;
+
+    sprintf(tmp, "%s.tmp", name);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        perror(tmp);
+        goto out;
+    }
+    rc = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(slots, sizeof(*slots), nslots, f) == nslots &&
+         fwrite(b->pool, 1, b->pool_len, f) == b->pool_len ? 0 : -1;
+    // Postings in the order their offsets were handed out above
+    for (size_t i = 0; rc == 0 && i < b->nslots; i++) {
+        const struct term_entry* e = &b->map[i];
+        if (e->term_len != 0 && fwrite(e->post, 1, e->post_len, f) != e->post_len) {
+            rc = -1;
+        }
+    }
+    if (fclose(f) != 0) {
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp, name) == -1) {
+        rc = -1;
+    }
+    if (rc == -1) {
+        perror(name);
+        unlink(tmp);
+    }
+
+out:
+    free(slots);
+    free(name);
+    free(tmp);
+    return rc;
+}
+
+int word_index_build(const char* path, int fd, const char* data, size_t size,
+                     Array* table, size_t* terms) {
+    struct builder b;
+    struct stat st;
+    const unsigned char* bytes = (const unsigned char*)data;
+    const unsigned char* p = bytes;
+    const unsigned char* end = bytes + size;
+    int rc = -1;
+
+    memset(&b, 0, sizeof(b));
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    if (builder_grow(&b) == -1) {
+        return -1;
+    }
+    // One pass: every line goes into the table and through the tokenizer
+    while (p < end) {
+        const unsigned char* nl = memchr(p, '\n', end - p);
+        const unsigned char* line_end = nl != NULL ? nl : end;
+        Line current = { p - bytes, line_end - p };
+        if (index_line(&b, p, line_end, table->cnt, current.offset) == -1 ||
+            insertArray(table, current) == -1) {
+            goto out;
+        }
+        p = nl != NULL ? nl + 1 : end;
+    }
+    *terms = b.terms;
+    rc = builder_save(&b, path, &st);
+
+out:
+    for (size_t i = 0; i < b.nslots; i++) {
+        free(b.map[i].post);
+    }
+    free(b.map);
+    free(b.pool);
+    return rc;
+}
+
+int word_index_open(WordIndex* wi, const char* path, int fd) {
+    char* name = widx_path(path);
+    struct stat st, text;
+    int wfd;
+
+    memset(wi, 0, sizeof(*wi));
+    if (name == NULL) {
+        return -1;
+    }
+    wfd = open(name, O_RDONLY | O_CLOEXEC);
+    free(name);
+    if (wfd == -1) {
+        return -1;
+    }
+    if (fstat(wfd, &st) == -1 || fstat(fd, &text) == -1) {
+        close(wfd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct widx_header)) {
+        close(wfd);
+        errno = EINVAL;
+        return -1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, wfd, 0);
+    close(wfd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    wi->map = map;
+    wi->size = st.st_size;
+
+    const struct widx_header* h = map;
+    if (memcmp(h->magic, widx_magic, sizeof(widx_magic)) != 0 || h->nslots == 0 ||
+        (h->nslots & (h->nslots - 1)) != 0 ||
+        h->nslots > (wi->size - sizeof(*h)) / sizeof(struct widx_slot) ||
+        h->pool_size != wi->size - sizeof(*h) - h->nslots * sizeof(struct widx_slot)) {
+        word_index_close(wi);
+        errno = EINVAL;
+        return -1;
+    }
+    if (h->file_size != (uint64_t)text.st_size || h->mtime_sec != text.st_mtim.tv_sec ||
+        h->mtime_nsec != text.st_mtim.tv_nsec) {
+        word_index_close(wi);
+        errno = ESTALE;
+        return -1;
+    }
+    wi->slots = wi->map + sizeof(*h);
+    wi->nslots = h->nslots;
+    wi->pool = wi->map + sizeof(*h) + h->nslots * sizeof(struct widx_slot);
+    wi->pool_size = h->pool_size;
+    return 0;
+}
+
+void word_index_close(WordIndex* wi) {
+    if (wi->map != NULL) {
+        munmap((void*)wi->map, wi->size);
+    }
+    memset(wi, 0, sizeof(*wi));
+}
+
+size_t word_normalize(const char* word, size_t len, char* out) {
+    const unsigned char* p = (const unsigned char*)word;
+    const unsigned char* end = p + len;
+    size_t n = 0;
+
+    while (p < end) {
+        uint32_t c;
+        size_t k = utf8_decode(p, end, &c);
+        p += k != 0 ? k : 1;
+        if (k != 0 && is_word_char(c)) {
+            if (n + 4 <= WORD_TERM_MAX) {
+                n += utf8_encode(to_lower(c), (unsigned char*)out + n);
+            }
+        } else if (n > 0) {
+            break;
+        }
+    }
+    return n;
+}
+
+int word_index_find(const WordIndex* wi, const char* word, WordPostings* out) {
+    char term[WORD_TERM_MAX + 4];
+    size_t len = word_normalize(word, strlen(word), term);
+    const struct widx_slot* slots = wi->slots;
+
+    if (len == 0 || wi->nslots == 0) {
+        return 0;
+    }
+    uint64_t hash = term_hash((const unsigned char*)term, len);
+    for (uint64_t s = hash & (wi->nslots - 1), probes = 0; probes < wi->nslots;
+         s = (s + 1) & (wi->nslots - 1), probes++) {
+        const struct widx_slot* slot = &slots[s];
+        if (slot->term_len == 0) {
+            return 0;
+        }
+        if (slot->hash == hash && slot->term_len == len && slot->term_off + len <= wi->pool_size &&
+            memcmp(wi->pool + slot->term_off, term, len) == 0) {
+            if (slot->post_off + slot->post_len > wi->pool_size) {
+                return 0;
+            }
+            out->p = wi->pool + slot->post_off;
+            out->end = out->p + slot->post_len;
+            out->left = slot->count;
+            out->line = 0;
+            out->offset = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int word_postings_next(WordPostings* it, size_t* line, off_t* offset) {
+    uint64_t dl, doff;
+
+    if (it->left == 0 || (it->p = get_varint(it->p, it->end, &dl)) == NULL ||
+        (it->p = get_varint(it->p, it->end, &doff)) == NULL) {
+        it->left = 0;
+        return 0;
+    }
+    it->left--;
+    it->line += dl;
+    it->offset += doff;
+    *line = it->line;
+    *offset = it->offset;
+    return 1;
+}
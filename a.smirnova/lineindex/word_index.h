@@ -0,0 +1,68 @@
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "line_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Inverted word index: term -> the lines it occurs in, kept in <file>.widx.
+ *
+ * Words are maximal runs of letters and digits in UTF-8 text, lowercased
+ * (ASCII, Latin-1 and Cyrillic); anything that is not valid UTF-8 splits
+ * words. Every posting is a pair of varint deltas, line number and line
+ * offset, so a lookup needs neither the line table nor a scan of the text:
+ * the index file is mapped and probed in place.
+ */
+
+#define WORD_TERM_MAX 64
+
+/*
+ * Build the line table of data/size (like build_line_table_mem) and, in
+ * the same pass over the text, the word index written to path.widx. fd is
+ * the open text file, whose size and mtime are stored to detect a stale
+ * index. *terms gets the number of distinct words.
+ */
+int word_index_build(const char* path, int fd, const char* data, size_t size,
+                     Array* table, size_t* terms);
+
+typedef struct {
+    const unsigned char* map;
+    size_t size;
+    const void* slots;
+    uint64_t nslots;
+    const unsigned char* pool;
+    uint64_t pool_size;
+} WordIndex;
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    uint32_t left;
+    size_t line;
+    off_t offset;
+} WordPostings;
+
+// Map path.widx; -1 with errno ESTALE when it no longer matches fd's file
+int word_index_open(WordIndex* wi, const char* path, int fd);
+void word_index_close(WordIndex* wi);
+
+// Normalize word as the tokenizer would (first word only); its length
+size_t word_normalize(const char* word, size_t len, char* out);
+
+// 1 and *out positioned on the term's postings, 0 if the word never occurs
+int word_index_find(const WordIndex* wi, const char* word, WordPostings* out);
+// 1 with the next zero-based line and its offset, 0 when done
+int word_postings_next(WordPostings* it, size_t* line, off_t* offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif